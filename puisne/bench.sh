@@ -0,0 +1,185 @@
+#!/bin/sh
+# Startup benchmarks for PUISNE, against synthetic packages.
+#
+#   puisne/bench.sh [-q] [-r runs] [-w dir] [path/to/puisne.com]
+#
+# Packages a trivial entrypoint with generated files along several axes (file
+# count, file size, stored vs deflated, flat vs deep trees), then times its
+# launch: "cold" into an empty destination, & "warm" again once extracted, for
+# both `-n` and `-m` (where the kernel allows). Prints median milliseconds
+# over `runs` launches each, as a table comparable between builds & hosts.
+# When run as root, the page cache is dropped before each cold launch.
+#
+#   -q       quick; skip the largest packages (100k files & 1 GiB).
+#   -r runs  launches per measurement; defaults to 5.
+#   -w dir   where to keep packages & destinations; defaults to a tempdir.
+#            Packages are reused from there when rerunning.
+#
+# The stub defaults to `o//puisne/puisne.com`, from a cosmopolitan build.
+
+set -eu
+
+quick=
+runs=5
+work=
+while getopts qr:w: opt; do
+  case $opt in
+    q) quick=1 ;;
+    r) runs=$OPTARG ;;
+    w) work=$OPTARG ;;
+    *) sed -n '2,18s/^# \{0,1\}//p' "$0" >&2; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+stub=$(realpath "${1:-o//puisne/puisne.com}")
+[ -n "$work" ] || work=$(mktemp -d "${TMPDIR:-/tmp}/puisne-bench.XXXXXX")
+mkdir -p "$work"
+work=$(realpath "$work")
+
+launch() {
+  # launch package mode dest; as root, `-m` would mount outside a namespace.
+  if [ "$2" = m ] && [ "$(id -u)" = 0 ]; then
+    unshare -m "$1" -- "-$2" -d "$3" > /dev/null
+  else
+    "$1" -- "-$2" -d "$3" > /dev/null
+  fi
+}
+
+now() {
+  date +%s%N
+}
+
+drop_caches() {
+  # Only root can, & only where there's a page cache to speak of.
+  if [ -w /proc/sys/vm/drop_caches ]; then
+    sync
+    echo 3 > /proc/sys/vm/drop_caches
+  fi
+}
+
+make_tree() {
+  # make_tree dir count size shape; deterministic content, so deflatable.
+  dir=$1 count=$2 size=$3 shape=$4
+  mkdir -p "$dir"
+  if [ "$size" -le 65536 ]; then
+    blob=$(yes "puisne benchmark $size" | head -c "$size")
+  fi
+  i=0 last=/
+  while [ "$i" -lt "$count" ]; do
+    if [ "$shape" = deep ]; then  # ie. a folder per digit, 10 files apiece.
+      d=$((i / 10)) sub=
+      while [ "$d" -gt 0 ]; do
+        sub=$((d % 10))/$sub d=$((d / 10))
+      done
+      if [ "$sub" != "$last" ]; then
+        mkdir -p "$dir/d/$sub"
+        last=$sub
+      fi
+      path=d/${sub}f$((i % 10))
+    else
+      path=f$i
+    fi
+    if [ "$size" -le 65536 ]; then
+      printf '%s' "$blob" > "$dir/$path"
+    else
+      yes "puisne benchmark $size $i" | head -c "$size" > "$dir/$path"
+    fi
+    i=$((i + 1))
+  done
+}
+
+make_package() {
+  # make_package count size method shape; prints the package's path.
+  id=$1-$2-$3-$4
+  package=$work/$id/bench.com
+  if [ ! -f "$package" ]; then
+    rm -rf "$work/$id"
+    mkdir -p "$work/$id/src/bench.app"
+    printf '#!/bin/sh\nexit 0\n' > "$work/$id/src/bench.app/bench"
+    chmod +x "$work/$id/src/bench.app/bench"
+    make_tree "$work/$id/src/bench.app/data" "$1" "$2" "$4"
+    cp "$stub" "$package.tmp"
+    if [ "$3" = stored ]; then level=-0; else level=-6; fi
+    (cd "$work/$id/src" && zip -q -r -D -g "$level" "$package.tmp" bench.app)
+    rm -rf "$work/$id/src"
+    mv "$package.tmp" "$package"
+  fi
+  echo "$package"
+}
+
+reset() {
+  # reset dest; with `-m`, PUISNE's stamp, lock &c. are beside it.
+  rm -rf "$1" "$1.stamp" "$1.lock" "$1.manifest"
+}
+
+median() {
+  sort -n | awk '{ v[NR] = $1 } END { printf "%.1f", v[int((NR + 1) / 2)] }'
+}
+
+measure() {
+  # measure package mode cold|warm; median of `runs` launches, in ms.
+  dest=$(dirname "$1")/dest.$2
+  if [ "$3" = warm ]; then
+    reset "$dest"
+    launch "$1" "$2" "$dest"
+  fi
+  r=0
+  while [ "$r" -lt "$runs" ]; do
+    if [ "$3" = cold ]; then
+      reset "$dest"
+      drop_caches
+    fi
+    start=$(now)
+    launch "$1" "$2" "$dest"
+    echo $((($(now) - start) / 1000))
+    r=$((r + 1))
+  done | median | awk '{ printf "%.1f", $1 / 1000 }'
+  reset "$dest"
+}
+
+# Does `-m` work here at all?
+mount_ok=
+probe=$(make_package 10 1024 stored flat)
+if launch "$probe" m "$(dirname "$probe")/dest.probe" 2> /dev/null; then
+  mount_ok=1
+fi
+reset "$(dirname "$probe")/dest.probe"
+
+# count size method shape
+cases="
+10 1024 stored flat
+10 1024 deflated flat
+1000 1024 stored flat
+1000 1024 deflated flat
+1000 1024 deflated deep
+100000 1024 deflated flat
+100000 1024 deflated deep
+1 1048576 stored flat
+1 1048576 deflated flat
+1 67108864 stored flat
+1 67108864 deflated flat
+1 1073741824 stored flat
+1 1073741824 deflated flat
+"
+
+printf '# %s, %s, %s CPUs, %d runs\n' "$(uname -sr)" "$stub" \
+  "$(getconf _NPROCESSORS_ONLN)" "$runs"
+printf '%8s %11s %-9s %-5s %10s %10s %10s %10s\n' files "size (B)" method \
+  tree "-n cold" "-n warm" "-m cold" "-m warm"
+echo "$cases" | while read -r count size method shape; do
+  [ -n "$count" ] || continue
+  if [ -n "$quick" ] && { [ "$count" -ge 100000 ] ||
+    [ "$size" -ge 1073741824 ]; }; then
+    continue
+  fi
+  package=$(make_package "$count" "$size" "$method" "$shape")
+  n_cold=$(measure "$package" n cold)
+  n_warm=$(measure "$package" n warm)
+  m_cold=- m_warm=-
+  if [ -n "$mount_ok" ]; then
+    m_cold=$(measure "$package" m cold)
+    m_warm=$(measure "$package" m warm)
+  fi
+  printf '%8s %11s %-9s %-5s %10s %10s %10s %10s\n' "$count" "$size" \
+    "$method" "$shape" "$n_cold" "$n_warm" "$m_cold" "$m_warm"
+done
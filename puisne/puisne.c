@@ -1,15 +1,46 @@
 #include "libc/calls/calls.h"
+#include "libc/calls/ioctl.h"
 #include "libc/calls/mount.h"
+#include "libc/calls/struct/dirent.h"
+#include "libc/calls/struct/iovec.h"
+#include "libc/calls/struct/rlimit.h"
 #include "libc/calls/struct/stat.h"
+#include "libc/calls/struct/timespec.h"
 #include "libc/calls/struct/utsname.h"
 #include "libc/dce.h"
+#include "libc/errno.h"
 #include "libc/fmt/conv.h"
+#include "libc/limits.h"
+#include "libc/macros.internal.h"
 #include "libc/mem/mem.h"
 #include "libc/runtime/runtime.h"
+#include "libc/sock/sock.h"
+#include "libc/sock/struct/pollfd.h"
+#include "libc/sock/struct/sockaddr.h"
+#include "libc/sock/struct/ucred.h"
 #include "libc/stdio/temp.h"
+#include "libc/sysv/consts/af.h"
+#include "libc/sysv/consts/at.h"
+#include "libc/sysv/consts/clock.h"
 #include "libc/sysv/consts/clone.h"
+#include "libc/sysv/consts/lock.h"
+#include "libc/sysv/consts/madv.h"
+#include "libc/sysv/consts/map.h"
+#include "libc/sysv/consts/mfd.h"
 #include "libc/sysv/consts/mount.h"
 #include "libc/sysv/consts/nr.h"
+#include "libc/sysv/consts/o.h"
+#include "libc/sysv/consts/poll.h"
+#include "libc/sysv/consts/posix.h"
+#include "libc/sysv/consts/prot.h"
+#include "libc/sysv/consts/pr.h"
+#include "libc/sysv/consts/rlimit.h"
+#include "libc/sysv/consts/s.h"
+#include "libc/sysv/consts/sig.h"
+#include "libc/sysv/consts/so.h"
+#include "libc/sysv/consts/sock.h"
+#include "libc/sysv/consts/sol.h"
+#include "libc/thread/thread.h"
 #include "libc/time/struct/tm.h"
 #include "libc/time/time.h"
 #include "libc/x/x.h"
@@ -17,6 +48,8 @@
 #include "libc/zip.h"
 #include "libc/zipos/zipos.internal.h"
 #include "third_party/getopt/getopt.h"
+#include "third_party/zlib/zlib.h"
+#include "third_party/zstd/zstd.h"
 #include "tool/args/args.h"
 
 // Some constants for mounting
@@ -27,28 +60,93 @@
 #define LINUX_KERNEL_MINOR_MIN 12
 #define LINUX_KERNEL_PATCH_MIN 0
 #define CLONE_NEWUSER          0x10000000 /* New user namespace */
+#ifndef FICLONE
+#define FICLONE 0x40049409  // _IOW(0x94, 9, int) per linux/fs.h
+#endif
+#ifndef NS_GET_PARENT
+#define NS_GET_PARENT 0xb702  // _IO(0xb7, 0x2) per linux/nsfs.h
+#endif
+#ifndef kZipCompressionZstd
+#define kZipCompressionZstd 93  // per APPNOTE.TXT 4.4.5
+#endif
 
 #define APP_SUFFIX ".app"
 
+// Largest buffer to inflate into at once, per thread.
+#define INFLATE_BUFSIZ (4 * 1024 * 1024)
+
 // Parameters (& defaults, if determinate):
 static char tidy_mode;      // -m: mount, -n: none
                             //   if running Linux & kernel >= 5.12.0: mount
                             //   else: none
-static char overlay = 'o';  // -o [over], under
-static char unzip = 'u';    // -u [update], all, new, existing, freshen, none
+static char overlay = 'o';  // -o [over], under, bind
+static char unzip = 'u';    // -u [update], all, new, existing, freshen, sync,
+                            //   lazy, none
 static char* unzip_dir;     // -d directory; default differs by mode.
                             //   mount: `dirname(argv[0])/.puisne/name.app`
                             //   none: `dirname(argv[0])`
-static char* work_dir;      // -w directory; defaults to some tempdir.
-                            //    Exposed in case that is on a different volume.
+static char* work_dir;      // -w directory; defaults to one in the tempdir,
+                            //   reused per package & invocation_dir.
+                            //   Exposed in case that is on a different volume.
+static int jobs;            // -j number of extraction threads; defaults to the
+                            //   number of CPUs.
+static char* cache_dir;     // -c [none], user, or directory; where to share
+                            //   extracted packages, per archive fingerprint.
+                            //   user: `$XDG_CACHE_HOME/puisne`
+static char link_mode = 'c';  // -l [clone], hard; how `-n` makes files from
+                              //   `cache_dir`.
+static bool make_index;       // -i: write `puisne/index.bin` into the PUISNE
+                              //   & exit.
+static int keep_seconds;      // -k seconds to keep the mount namespace for
+                              //   later launches, once idle; default 0, not.
+static bool memory_exec;      // -e: run the entrypoint from memory, rather
+                              //   than extracting it; Linux only.
+static bool prepare_only;     // -x: extract & exit; 2 if there was nothing
+                              //   to.
+static bool background;       // -b: extract what the app starts with, then
+                              //   the rest alongside it; needs -n.
 
 // Globals
 static char* name;            // Name of the package
 static char* invocation_dir;  // Where the PUISNE executable appears.
-
-char** files = 0;         // Array of filenames in zip object store,
-int64_t* timestamps = 0;  // timestamps for same,
-int* modes = 0;           // & permissions &c.
+static char* persist_dir;     // Where the app's writes persist with `-o over`;
+                              //   `unzip_dir`, unless that's in `cache_dir`.
+
+struct Entry {              // A file (or directory) of the app, per its
+  uint64_t record;          //   central directory record's offset in the map:
+  uint64_t offset;          //   its local file header's,
+  uint64_t compressed_size;
+  uint64_t size;            //   uncompressed,
+  int64_t mtime;
+  uint32_t path;            //   its app-relative path's offset in `paths`,
+  uint32_t path_size;       //   & length,
+  uint32_t crc;
+  uint32_t mode;            //   type & permissions,
+  uint16_t method;          //   & compression method.
+  uint16_t padding[3];
+};
+struct Entry* entries = 0;  // Compactly, in central directory order (or per
+char* paths = 0;            //   `puisne/index.bin`), each path NUL-terminated,
+int n_entries = 0;          //   one after another. Length of the above.
+static bool indexed;        // Whether those are in the map, not the heap.
+static int archive_fd = -1;  // The PUISNE itself, opened for reading.
+
+// Tracing, per `PUISNE_TRACE`:
+static int trace_fd = -1;    // Where timings are reported; -1 if not at all.
+static int64_t trace_epoch;  // When PUISNE started, in monotonic ns.
+static int64_t trace_file_ns = 10000000;  // Report files slower than this.
+
+// Statistics, per `PUISNE_STATS`:
+static int stats_fd = -1;  // Where they're reported; -1 if not at all.
+static struct Stats {      // Of files in the app, over each `extract_tree`:
+  uint64_t skipped;        //   those left as they were, per the `-u` rule,
+  uint64_t extracted;      //   & those written;
+  uint64_t dirs;           //   directories made,
+  uint64_t bytes_read;     //   bytes read from the archive for those files,
+  uint64_t bytes_written;  //   & written to them.
+} stats;
+static bool cache_missed;  // Whether the `-c` cache had to be extracted to,
+static bool joined;        //   & whether a kept namespace was joined (`-k`).
 
 void split_args(int* argc, char*** argv, int* package_argc,
                 char*** package_argv) {
@@ -104,6 +202,98 @@ void fix_path(char** path) {
   }
 }
 
+int64_t trace_clock(void) {
+  /*
+      Monotonic time in ns, if tracing (or reporting statistics); else 0 & no
+      syscall.
+  */
+
+  if (trace_fd == -1 && stats_fd == -1) {
+    return 0;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void start_trace(void) {
+  /*
+      Enables tracing if `PUISNE_TRACE` is set: "1" or "stderr" reports to
+      stderr, anything else is a file to append to. `PUISNE_TRACE_FILE_MS`
+      sets how slow a file must be to extract to be reported.
+      This is read before anything else, so `process_args` is covered too.
+  */
+
+  char* trace = getenv("PUISNE_TRACE");
+  if (!trace || !*trace || !strcmp(trace, "0")) {
+    return;
+  }
+  if (!strcmp(trace, "1") || !strcmp(trace, "stderr")) {
+    trace_fd = 2;
+  } else {
+    trace_fd = open(trace, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd == -1) {
+      fprintf(stderr, "PUISNE: Couldn't open trace file `%s`!\n", trace);
+      exit(1);
+    }
+  }
+  char* file_ms = getenv("PUISNE_TRACE_FILE_MS");
+  if (file_ms && *file_ms) {
+    trace_file_ns = strtod(file_ms, 0) * 1e6;
+  }
+  trace_epoch = trace_clock();
+}
+
+void start_stats(void) {
+  /*
+      Enables statistics if `PUISNE_STATS` is set, much as `start_trace`: "1"
+      or "stderr", or a file to append to (eg. `/dev/fd/3`).
+  */
+
+  char* path = getenv("PUISNE_STATS");
+  if (!path || !*path || !strcmp(path, "0")) {
+    return;
+  }
+  if (!strcmp(path, "1") || !strcmp(path, "stderr")) {
+    stats_fd = 2;
+  } else {
+    stats_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (stats_fd == -1) {
+      fprintf(stderr, "PUISNE: Couldn't open stats file `%s`!\n", path);
+      exit(1);
+    }
+  }
+  if (trace_fd == -1) {  // ie. not already set by `start_trace`.
+    trace_epoch = trace_clock();
+  }
+}
+
+void trace(const char* phase, const char* detail, int64_t since) {
+  /*
+      Reports how long `phase` took, ie. since `since` (per `trace_clock`), &
+      when it finished, relative to startup. Each is a single write, so lines
+      from several threads don't interleave.
+  */
+
+  if (trace_fd == -1) {
+    return;
+  }
+  int64_t now = trace_clock();
+  dprintf(trace_fd, "PUISNE: trace %10.3fms %10.3fms %s%s%s\n",
+          (now - trace_epoch) / 1e6, (now - since) / 1e6, phase,
+          detail ? " " : "", detail ? detail : "");
+}
+
+void trace_file(const char* phase, const char* file, int64_t since) {
+  /*
+      Reports `file`, if it was slower than `trace_file_ns` to write.
+  */
+
+  if (trace_fd != -1 && trace_clock() - since >= trace_file_ns) {
+    trace(phase, file, since);
+  }
+}
+
 void print_help(void) {
   /*
       Prints PUISNE help file or an error; exit either way.
@@ -186,7 +376,7 @@ void parse_options(int argc, char** argv) {
   */
 
   int opt, opt_index;
-  while ((opt = getopt(argc, argv, ":mno:d:w:u:h")) != -1) {
+  while ((opt = getopt(argc, argv, ":mno:d:w:u:j:c:l:k:eixbh")) != -1) {
     switch (opt) {
       case 'm':
         tidy_mode = 'm';  // mount
@@ -195,8 +385,10 @@ void parse_options(int argc, char** argv) {
         tidy_mode = 'n';  // none
         break;
       case 'o':
-        if (strcmp(optarg, "over") && strcmp(optarg, "under")) {
-          fprintf(stderr, "PUISNE: Argument to -o must be in {over,under}!\n");
+        if (strcmp(optarg, "over") && strcmp(optarg, "under") &&
+            strcmp(optarg, "bind")) {
+          fprintf(stderr,
+                  "PUISNE: Argument to -o must be in {over,under,bind}!\n");
           exit(1);
         }
         overlay = optarg[0];
@@ -207,12 +399,24 @@ void parse_options(int argc, char** argv) {
       case 'w':
         work_dir = optarg;
         break;
+      case 'c':
+        cache_dir = strcmp(optarg, "none") ? optarg : 0;
+        break;
+      case 'l':
+        if (strcmp(optarg, "clone") && strcmp(optarg, "hard")) {
+          fprintf(stderr, "PUISNE: Argument to -l must be in {clone,hard}!\n");
+          exit(1);
+        }
+        link_mode = optarg[0];
+        break;
       case 'u':
         if (strcmp(optarg, "all") && strcmp(optarg, "new") &&
             strcmp(optarg, "existing") && strcmp(optarg, "update") &&
-            strcmp(optarg, "freshen") && strcmp(optarg, "none")) {
+            strcmp(optarg, "freshen") && strcmp(optarg, "sync") &&
+            strcmp(optarg, "verify") && strcmp(optarg, "lazy") &&
+            strcmp(optarg, "none")) {
           fprintf(stderr, "PUISNE: Argument to -u must be in {all,new,existing,"
-                          "update,freshen,none}!\n");
+                          "update,freshen,sync,verify,lazy,none}!\n");
           exit(1);
         }
         if (!strcmp(optarg, "none")) {
@@ -221,6 +425,33 @@ void parse_options(int argc, char** argv) {
           unzip = optarg[0];
         }
         break;
+      case 'j':
+        jobs = atoi(optarg);
+        if (jobs < 1) {
+          fprintf(stderr,
+                  "PUISNE: Argument to -j must be a positive number!\n");
+          exit(1);
+        }
+        break;
+      case 'k':
+        keep_seconds = atoi(optarg);
+        if (keep_seconds < 0) {
+          fprintf(stderr, "PUISNE: Argument to -k must be a number!\n");
+          exit(1);
+        }
+        break;
+      case 'e':
+        memory_exec = TRUE;
+        break;
+      case 'i':
+        make_index = TRUE;
+        break;
+      case 'x':
+        prepare_only = TRUE;
+        break;
+      case 'b':
+        background = TRUE;
+        break;
       case 'h':
         print_help();  // No reason to go on, just print help & exit.
         break;
@@ -254,17 +485,52 @@ void parse_options(int argc, char** argv) {
       tidy_mode = 'n';
     }
   }
+  if (unzip == 'l' && tidy_mode != 'm') {
+    fprintf(stderr, "PUISNE: -u lazy needs to mount, ie. -m!\n");
+    exit(1);
+  }
+  if (keep_seconds && (tidy_mode != 'm' || unzip == 'l')) {
+    fprintf(stderr, "PUISNE: -k needs to mount, ie. -m, but not -u lazy!\n");
+    exit(1);
+  }
+  if (background && tidy_mode != 'n') {  // A mount's layers mustn't change.
+    fprintf(stderr, "PUISNE: -b needs not to mount, ie. -n!\n");
+    exit(1);
+  }
+  if (prepare_only) {  // Nothing to start, so no hurry.
+    background = FALSE;
+  }
+
+  if (memory_exec && !IsLinux()) {  // Nowhere to run it from but the disk.
+    memory_exec = FALSE;
+  }
 
   // Set defaults that can be determined now;
   //   `unzip_dir` might depend on `name`; see `extract_files`.
-  if (!work_dir) {
-    work_dir = xjoinpaths(kTmpPath, "puisne.XXXXXX");
+  if (!jobs) {
+    jobs = MAX(1, _getcpucount());
+  }
+  if (work_dir) {  // Otherwise, see `set_work_dir`.
+    fix_path(&work_dir);
   }
-  fix_path(&work_dir);
 
   if (unzip_dir) {
     fix_path(&unzip_dir);
   }
+
+  if (cache_dir && unzip == 'l') {  // Nothing to cache.
+    cache_dir = 0;
+  }
+  if (cache_dir && !strcmp(cache_dir, "user")) {
+    if (getenv("XDG_CACHE_HOME")) {
+      cache_dir = xjoinpaths(getenv("XDG_CACHE_HOME"), "puisne");
+    } else {
+      cache_dir = "~/.cache/puisne";
+    }
+  }
+  if (cache_dir) {
+    fix_path(&cache_dir);
+  }
 }
 
 void process_args(int* argc, char*** argv) {
@@ -288,170 +554,240 @@ void process_args(int* argc, char*** argv) {
 int64_t get_time_offset() {
   /*
       Gets local time offset relative to GMT.
+      Only worked out the first time it's needed (see `has_utc_timestamp`), as
+      that means loading the zoneinfo.
   */
 
-  struct tm tm;
-  int64_t t;
-  time(&t);
-  localtime_r(&t, &tm);
+  static bool known;
+  static int64_t offset;
+  if (!known) {
+    struct tm tm;
+    int64_t t;
+    time(&t);
+    localtime_r(&t, &tm);
+    offset = tm.tm_gmtoff;
+    known = TRUE;
+  }
 
-  return tm.tm_gmtoff;
+  return offset;
 }
 
-void process_package_structure() {
+bool has_utc_timestamp(const uint8_t* cfile) {
   /*
-      Determines files in the zip object store & their metadata.
-      Makes sure only expected files are present, or errors out.
+      Whether a central directory record has its modification time in UTC
+      too, rather than only as local DOS time; ie. an Info-ZIP extended
+      timestamp (as `zip` adds, unless `-X`) or NTFS times in its extra field.
   */
 
-  struct Zipos* zip = __zipos_get();  // 🦛
-
-  files = malloc(sizeof(char*) * (ZIP_CDIR_RECORDS(zip->cdir) + 1));
-  timestamps = malloc(sizeof(int64_t) * (ZIP_CDIR_RECORDS(zip->cdir) + 1));
-  modes = malloc(sizeof(int) * (ZIP_CDIR_RECORDS(zip->cdir) + 1));
+  const uint8_t* extra = ZIP_CFILE_EXTRA(cfile);
+  const uint8_t* end = extra + ZIP_CFILE_EXTRASIZE(cfile);
+  for (; extra + kZipExtraHdrSize <= end; extra += ZIP_EXTRA_SIZE(extra)) {
+    switch (ZIP_EXTRA_HEADERID(extra)) {
+      case kZipExtraExtendedTimestamp:
+        if (ZIP_EXTRA_CONTENTSIZE(extra) >= 5 &&
+            (*ZIP_EXTRA_CONTENT(extra) & 1)) {  // ie. has the mtime.
+          return TRUE;
+        }
+        break;
+      case kZipExtraNtfs:
+        if (ZIP_EXTRA_CONTENTSIZE(extra) >= 32) {
+          return TRUE;
+        }
+        break;
+    }
+  }
+  return FALSE;
+}
 
-  int64_t time_offset = get_time_offset();
+char* sidecar_path(const char* dir, const char* suffix) {
+  /*
+      Path of some state PUISNE keeps about a directory it extracts to; beside
+      it, eg. `.puisne/name.stamp` by `.puisne/name.app`, as with `-m` it's a
+      layer of the mount, which the app shouldn't see (nor write) such files
+      in. The `-n` destination is most likely the working environment; there,
+      it's in `.puisne/` within, rather than littering it.
+  */
 
-  for (int i = 0, record_offset = ZIP_CDIR_OFFSET(zip->cdir);
-       i < ZIP_CDIR_RECORDS(zip->cdir);
-       i++, record_offset += ZIP_CFILE_HDRSIZE(zip->map + record_offset)) {
+  if (tidy_mode == 'n' && persist_dir && !strcmp(dir, persist_dir)) {
+    return xasprintf("%s/.puisne/%s", dir, suffix);
+  }
+  size_t size = strlen(dir);
+  while (size > 1 && dir[size - 1] == '/') {
+    size--;
+  }
+  size_t suffix_size = strlen(APP_SUFFIX);
+  if (size > suffix_size &&
+      !memcmp(dir + size - suffix_size, APP_SUFFIX, suffix_size)) {
+    size -= suffix_size;
+  }
+  return xasprintf("%.*s.%s", (int)size, dir, suffix);
+}
 
-    char* file = xstrndup(ZIP_CFILE_NAME(zip->map + record_offset),
-                          ZIP_CFILE_NAMESIZE(zip->map + record_offset));
+bool is_puisne_file(const char* file, size_t size) {
+  /*
+      Whether a file in the zip object store belongs to PUISNE (or
+      Cosmopolitan) rather than the package; these are allowed & ignored.
+      Names in the central directory aren't NUL-terminated, hence `size`.
+  */
 
-    // Allow & ignore some PUISNE specific stuff:
-    if (memcmp(file, "puisne/", 7) == 0) {
-      files[i] = "";
-      free(file);
-      continue;
-    }
-    if (memcmp(file, ".args", 5) == 0) {
-      files[i] = "";
-      free(file);
-      continue;
-    }
-    if (memcmp(file, ".cosmo", 6) == 0) {
-      files[i] = "";
-      free(file);
-      continue;
-    }
+  if (size >= 7 && memcmp(file, "puisne/", 7) == 0) {
+    return TRUE;
+  }
+  if (size >= 5 && memcmp(file, ".args", 5) == 0) {
+    return TRUE;
+  }
+  if (size >= 6 && memcmp(file, ".cosmo", 6) == 0) {
+    return TRUE;
+  }
 
-    // TODO: Is there a way to get timezone info without this?
-    if (memcmp(file, "usr/share/zoneinfo/", 19) == 0) {
-      files[i] = "";
-      free(file);
-      continue;
-    }
+  // Needed only for entries without UTC timestamps; see `get_time_offset`.
+  if (size >= 19 && memcmp(file, "usr/share/zoneinfo/", 19) == 0) {
+    return TRUE;
+  }
+  return FALSE;
+}
 
-    char* file_split = strsep(&file, "/");
-    // file_split is whatever is in the root level,
-    // file is mutated to everything below that (ie. app-relative path).
+char* entry_path(int i) {
+  return paths + entries[i].path;
+}
 
-    if (file == NULL) {
-      fprintf(stderr, "PUISNE: Additional file `%s` in top level!\n",
-              file_split);
-      exit(1);
-    }
+static struct Entry entrypoint;     // For `-e`, the entrypoint's entry,
+static int entrypoint_index = -2;   //   its index in `entries` (-1 if not
+                                    //   there), or -2 if not yet looked for.
 
-    // App folder has to end with the suffix.
-    if (!_endswith(file_split, APP_SUFFIX)) {
-      fprintf(stderr, "PUISNE: Problematic top-level folder `%s`!\n",
-              file_split);
-      exit(1);
-    }
+bool find_entrypoint(void) {
+  /*
+      Looks for the entrypoint, ie. `name` in the app folder, per `entries`
+      if they're loaded; otherwise, eg. when warm, in the central directory.
+  */
 
-    // Disallow no-name app folder.
-    if (!strcmp(xstripext(file_split), "")) {
-      fprintf(stderr, "PUISNE: Invalid app folder `%s`!\n", APP_SUFFIX);
-      exit(1);
-    }
+  if (entrypoint_index != -2) {
+    return S_ISREG(entrypoint.mode);
+  }
+  entrypoint_index = -1;
 
-    // We either just learned our app's name for the first time, or need to
-    // confirm it hasn't changed (ie. we have multiple .app/ folders).
-    if (name) {
-      if (strcmp(name, xstripext(file_split))) {  // Three's a crowd.
-        fprintf(stderr, "PUISNE: Found multiple top level app folders!\n");
-        exit(1);
+  if (entries) {
+    for (int i = 0; i < n_entries; i++) {
+      if (!S_ISDIR(entries[i].mode) && !strcmp(entry_path(i), name)) {
+        entrypoint = entries[i];
+        entrypoint_index = i;
+        return TRUE;
       }
-    } else {
-      name = xstripext(file_split);  // Nice to meet you.
     }
-
-    // Get metadata too:
-    struct timespec modified_time;
-    GetZipCfileTimestamps(zip->map + record_offset, &modified_time, NULL, NULL,
-                          time_offset);
-    timestamps[i] = modified_time.tv_sec;
-
-    modes[i] = GetZipCfileMode(zip->map + record_offset);
-
-    // Store & clean-up:
-    files[i] = xstrdup(file);
-    free(file_split);
+    return FALSE;
   }
 
-  if (!name) {  // If we found nothing...
-    print_empty();
+  struct Zipos* zip = __zipos_get();
+  char* file = xasprintf("%s%s/%s", name, APP_SUFFIX, name);
+  size_t file_size = strlen(file);
+  for (uint64_t i = 0, record_offset = GetZipCdirOffset(zip->cdir);
+       i < GetZipCdirRecords(zip->cdir);
+       i++, record_offset += ZIP_CFILE_HDRSIZE(zip->map + record_offset)) {
+    const uint8_t* cfile = zip->map + record_offset;
+    if (ZIP_CFILE_NAMESIZE(cfile) == file_size &&
+        !memcmp(ZIP_CFILE_NAME(cfile), file, file_size)) {
+      entrypoint = (struct Entry){
+          .record = record_offset,
+          .offset = GetZipCfileOffset(cfile),
+          .compressed_size = GetZipCfileCompressedSize(cfile),
+          .size = GetZipCfileUncompressedSize(cfile),
+          .crc = ZIP_CFILE_CRC32(cfile),
+          .mode = (GetZipCfileMode(cfile) & 07777) | S_IFREG,
+          .method = ZIP_CFILE_COMPRESSIONMETHOD(cfile),
+      };
+      break;
+    }
   }
+  free(file);
+  return S_ISREG(entrypoint.mode);
 }
 
-void extract_file(char* zip_file, char* local_file, int mode) {
+bool entrypoint_is_script(void) {
   /*
-      Extract a single file¹ & remove it from our list of things to process.
-
-      ¹or make a directory blahblahblah...
+      Whether the entrypoint begins with "#!", so can't run from memory: the
+      interpreter is only told where it is, & `/dev/fd/...` is gone by then.
   */
 
-  // zipOS may explicitly include directories:
-  if (_endswith(zip_file, "/")) {
-    makedirs(local_file, mode);
-    return;
+  struct Zipos* zip = __zipos_get();
+  const uint8_t* data = ZIP_LFILE_CONTENT(zip->map + entrypoint.offset);
+  unsigned char magic[2] = {0};
+  if (entrypoint.method == kZipCompressionNone) {
+    memcpy(magic, data, MIN(2, entrypoint.size));
+  } else if (entrypoint.method == kZipCompressionDeflate) {
+    z_stream zs = {0};
+    zs.next_in = (unsigned char*)data;
+    zs.avail_in = MIN(entrypoint.compressed_size, UINT_MAX);
+    zs.next_out = magic;
+    zs.avail_out = 2;
+    if (inflateInit2(&zs, -MAX_WBITS) == Z_OK) {
+      inflate(&zs, Z_SYNC_FLUSH);
+      inflateEnd(&zs);
+    }
+  } else if (entrypoint.method == kZipCompressionZstd) {
+    ZSTD_DStream* zs = ZSTD_createDStream();
+    ZSTD_inBuffer in = {data, entrypoint.compressed_size, 0};
+    ZSTD_outBuffer out = {magic, 2, 0};
+    if (zs) {
+      ZSTD_decompressStream(zs, &out, &in);
+      ZSTD_freeDStream(zs);
+    }
   }
+  return !memcmp(magic, "#!", 2);
+}
 
-  // If not, we might need to make them in advance:
-  if (!isdirectory(xdirname(local_file))) {
-    makedirs(xdirname(local_file), 0755);
-  }
+char* find_package_name(void) {
+  /*
+      Finds the package name from the first file in the app folder, without
+      walking the whole central directory; nor checking it, see
+      `process_package_structure` for that.
+  */
 
-  FILE *fi, *fo;
-  unsigned char buffer[BUFSIZ];
-  fi = fopen(xstrcat("/zip/", name, APP_SUFFIX, '/', zip_file), "rb");
-  if (!fi) {
-    fprintf(stderr, "PUISNE: Zip error reading file `%s`!\n", zip_file);
-    exit(1);
-  }
-  fo = fopen(local_file, "wb");
-  if (!fo) {
-    fprintf(stderr, "PUISNE: Write error extracting `%s`.\n", local_file);
-    exit(1);
+  struct Zipos* zip = __zipos_get();
+  for (uint64_t i = 0, record_offset = GetZipCdirOffset(zip->cdir);
+       i < GetZipCdirRecords(zip->cdir);
+       i++, record_offset += ZIP_CFILE_HDRSIZE(zip->map + record_offset)) {
+    const char* file = ZIP_CFILE_NAME(zip->map + record_offset);
+    size_t size = ZIP_CFILE_NAMESIZE(zip->map + record_offset);
+    if (is_puisne_file(file, size)) {
+      continue;
+    }
+    const char* slash = memchr(file, '/', size);
+    char* top = xstrndup(file, slash ? slash - file : size);
+    char* found = xstripext(top);
+    free(top);
+    return found;
   }
+  return 0;
+}
 
-  int count;
-  while (count = fread(buffer, sizeof(buffer[0]), BUFSIZ, fi)) {
-    fwrite(buffer, sizeof(buffer[0]), count, fo);
+char* get_fingerprint(void) {
+  /*
+      Something to tell this archive from any other; the location, size &
+      CRC32 of the central directory, which lists every file's CRC32 in turn.
+  */
+
+  static char* fingerprint;
+  if (!fingerprint) {
+    struct Zipos* zip = __zipos_get();
+    fingerprint = xasprintf(
+        "%llx-%llx-%08lx", (unsigned long long)GetZipCdirOffset(zip->cdir),
+        (unsigned long long)GetZipCdirSize(zip->cdir),
+        crc32(0, zip->map + GetZipCdirOffset(zip->cdir),
+              GetZipCdirSize(zip->cdir)));
   }
-  fclose(fi);
-  fclose(fo);
-  chmod(local_file, mode);
+  return fingerprint;
 }
 
-void extract_files(void) {
+void set_unzip_dir(void) {
   /*
-      Since the package in the object store checks out, extract the files to
-      wherever specified by `-d`.
-      This actually compares the timestamp in the zip object store & file
-      on-disk, and only extracts (/overwrites) if the zipOS is newer; this is
-      basically a way to cache (so you don't need to re-extract each run), or
-      to maintain user/runtime edits. The latter can be propogated to the
-      package itself via
-      ```sh
-      zip -d package.com package.app/\* \
-          && zip -r package.com "package.app"
-      ```
-      (`zip -FS` will remove additional PUISNE/Cosmopolitan files).
+      Last chance to set `unzip_dir`, if it hasn't yet...
+      With `-c`, the package is extracted to (or found in) the cache instead,
+      shared by all copies of this archive; the destination only takes writes.
   */
 
-  // Last chance to set `unzip_dir`, if it hasn't yet...
+  if (persist_dir) {
+    return;
+  }
   if (!unzip_dir) {
     if (tidy_mode == 'n') {
       unzip_dir = invocation_dir;
@@ -462,156 +798,2810 @@ void extract_files(void) {
           APP_SUFFIX);
     }
   }
+  persist_dir = unzip_dir;
+  if (cache_dir) {
+    unzip_dir = xasprintf("%s/%s/%s%s", cache_dir, get_fingerprint(), name,
+                          APP_SUFFIX);
+  }
+}
 
-  if (makedirs(unzip_dir, 0755)) {
-    fprintf(stderr, "PUISNE: Couldn't make app folder `%s`!\n", unzip_dir);
-    exit(1);
-  };
+char* stamp_line(const char* dir, bool partial) {
+  /*
+      What `write_stamp` writes for `dir`, sans newline: the archive's
+      fingerprint, & the device & inode of `dir`, as the stamp is kept beside
+      it (see `sidecar_path`); so a stamp outlives its tree only unawares if
+      that's made anew in the very same inode. 0 if there's no `dir`.
+  */
 
-  for (int i = 0; files[i]; i++) {
+  struct stat st;
+  if (stat(dir, &st)) {
+    return 0;
+  }
+  return xasprintf("%s %llx:%llx%s", get_fingerprint(),
+                   (unsigned long long)st.st_dev,
+                   (unsigned long long)st.st_ino, partial ? " -e" : "");
+}
 
-    if (!strlen(files[i])) {
-      continue;
-    }
+bool stamp_matches(const char* dir) {
+  /*
+      Whether `dir` was fully extracted from this very archive, per the stamp
+      left by `write_stamp`; or, for `-e`, all but the entrypoint. Unless
+      partial, the entrypoint must be there still, too; eg. the destination
+      was removed & made again by someone else, as an inode may be reused.
+  */
 
-    char* local_file = xjoinpaths(unzip_dir, files[i]);
+  char* path = sidecar_path(dir, "stamp");
+  FILE* fi = fopen(path, "r");
+  free(path);
+  if (!fi) {
+    return FALSE;
+  }
 
-    if (unzip == 'a') {  // Brute-force is always simple...
-      extract_file(files[i], local_file, modes[i]);
-      free(files[i]);
-      free(local_file);
-      continue;
-    }
+  char line[256] = "";
+  bool got = fgets(line, sizeof(line), fi);
+  fclose(fi);
+  char* whole = stamp_line(dir, FALSE);
+  char* partial = memory_exec ? stamp_line(dir, TRUE) : 0;
+  char* entrypoint = xjoinpaths(dir, name);
+  size_t size = strlen(line);
+  if (got && size && line[size - 1] == '\n') {
+    line[size - 1] = 0;
+  }
+  bool matches = got && whole &&
+                 ((!strcmp(line, whole) && !access(entrypoint, F_OK)) ||
+                  (partial && !strcmp(line, partial)));
+  free(entrypoint);
+  free(partial);
+  free(whole);
+  return matches;
+}
 
-    // More selective extraction logic:
-    struct stat st;
-    int s = stat(local_file, &st);
-
-    if (!s) {  // The file exists.
-      switch (unzip) {
-        case 'n':
-          free(files[i]);
-          free(local_file);
-          continue;
-        case 'u':
-          // u & f are equivalent here...
-        case 'f':
-          if (st.st_ctim.tv_sec > timestamps[i]) {
-            free(files[i]);
-            free(local_file);
-            continue;
-          }
-      }
-    } else {  // It don't.
-      switch (unzip) {
-        case 'f':
-          // f & e are equivalent here...
-        case 'e':
-          free(files[i]);
-          free(local_file);
-          continue;
-      }
-    }
+int lock_sidecar(const char* dir, int operation) {
+  /*
+      Takes `operation`, ie. `LOCK_SH` or `LOCK_EX`, on the lock sidecar of
+      `dir` (see `sidecar_path`), waiting for it if need be: shared by
+      launches only checking the stamp, exclusive to whichever one extracts
+      there. So of many launched
+      at once, one extracts & the rest wait, then find it done. Returns the
+      lock's fd to close, or -1 if it couldn't be had, eg. `dir` isn't there
+      yet; that's no reason not to carry on.
+  */
 
-    // If we made it this far, we must want this file!
-    extract_file(files[i], local_file, modes[i]);
-    free(files[i]);
-    free(local_file);
+  int64_t t = trace_clock();
+  char* path = sidecar_path(dir, "lock");
+  // Read-write, as NFS takes `flock`s as POSIX locks, & exclusive ones only
+  // on fds open for writing; read-only will do if that's all we may.
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1 && (errno == EACCES || errno == EROFS)) {
+    fd = open(path, O_RDONLY | O_CLOEXEC);
   }
-
-  free(files);
-  free(timestamps);
-  free(modes);
+  if (fd == -1) {
+    trace("lock_sidecar: no lock", path, t);
+  }
+  while (fd != -1 && flock(fd, operation)) {
+    if (errno != EINTR) {  // eg. ENOLCK, on some network filesystems.
+      fprintf(stderr, "PUISNE: Couldn't lock `%s`; carrying on unlocked.\n",
+              path);
+      close(fd);
+      fd = -1;
+    }
+  }
+  free(path);
+  return fd;
 }
 
-void mount_in_namespace(void) {
+void write_stamp(const char* dir, bool partial) {
   /*
-      If we're in Linux, use a mount namespace to overlay the extracted files
-      & the package's unzip_dir.
+      Marks `dir` as fully extracted from this archive, or all but the
+      entrypoint if `partial` (see `-e`); written aside & renamed into place.
   */
 
-  int uid = getuid();
-  int gid = getgid();
-  int m;
+  char* path = sidecar_path(dir, "stamp");
+  char* temp_path = xstrcat(path, ".tmp");
+  char* line = stamp_line(dir, partial);
+  FILE* fo = line ? fopen(temp_path, "w") : 0;
+  if (!fo || fprintf(fo, "%s\n", line) < 0 || fclose(fo) ||
+      rename(temp_path, path)) {
+    fprintf(stderr, "PUISNE: Couldn't write stamp `%s`!\n", path);
+    unlink(temp_path);
+  }
+  free(line);
+  free(temp_path);
+  free(path);
+}
 
-  char* upper_dir;
-  char* lower_dir;
-  char* mount_data_string;
+// `puisne/index.bin`: the entries & their paths, exactly as they're laid out
+// in memory, so they can be used straight from the map. Stored first in the
+// central directory, so it's found without walking that.
+#define INDEX_FILE  "puisne/index.bin"
+#define INDEX_MAGIC "PUISNE\0\1"  // Bump with any change to `struct Entry`.
+#define INDEX_ALIGN 0xd935         // Extra field padding content, per zipalign.
+
+struct IndexHeader {
+  char magic[8];
+  uint64_t cdir_offset;  // The central directory this was made for; if the
+  uint64_t cdir_size;    //   archive was changed since, eg. `zip -g`, it no
+  uint64_t cdir_records; //   longer matches & is ignored.
+  uint32_t n_entries;    // Followed by that many entries, sorted by path,
+  uint32_t paths_size;   //   then their paths,
+  uint32_t name;         //   the package name among which.
+  uint32_t padding;
+};
+
+bool load_index(void) {
+  /*
+      Uses `puisne/index.bin` for `entries` & `paths`, if the package has one
+      that's up to date.
+  */
 
-  FILE* fo;
+  struct Zipos* zip = __zipos_get();
+  const uint8_t* cfile = zip->map + GetZipCdirOffset(zip->cdir);
+  if (!GetZipCdirRecords(zip->cdir) ||
+      ZIP_CFILE_NAMESIZE(cfile) != strlen(INDEX_FILE) ||
+      memcmp(ZIP_CFILE_NAME(cfile), INDEX_FILE, strlen(INDEX_FILE)) ||
+      ZIP_CFILE_COMPRESSIONMETHOD(cfile) != kZipCompressionNone) {
+    return FALSE;
+  }
 
-  if (overlay == 'o') {
-    upper_dir = unzip_dir;
-    lower_dir = invocation_dir;
-  } else {
-    upper_dir = invocation_dir;
-    lower_dir = unzip_dir;
+  const uint8_t* data =
+      ZIP_LFILE_CONTENT(zip->map + GetZipCfileOffset(cfile));
+  size_t size = GetZipCfileUncompressedSize(cfile);
+  const struct IndexHeader* header = (const struct IndexHeader*)data;
+  if ((uintptr_t)data % 8 || size < sizeof(*header) ||
+      memcmp(header->magic, INDEX_MAGIC, 8) ||
+      header->cdir_offset != GetZipCdirOffset(zip->cdir) ||
+      header->cdir_size != GetZipCdirSize(zip->cdir) ||
+      header->cdir_records != GetZipCdirRecords(zip->cdir) ||
+      size != sizeof(*header) + sizeof(struct Entry) * header->n_entries +
+                  header->paths_size ||
+      !header->paths_size || header->name >= header->paths_size) {
+    return FALSE;
   }
 
-  work_dir = mkdtemp(work_dir);
+  entries = (struct Entry*)(header + 1);
+  n_entries = header->n_entries;
+  paths = (char*)(entries + n_entries);
+  if (paths[header->paths_size - 1]) {
+    return FALSE;
+  }
+  if (!name) {
+    name = paths + header->name;
+  }
+  indexed = TRUE;
+  return TRUE;
+}
 
-  if (uid || gid) {  // If we aren't already root:
-    // Fake it 'til you make it.
-    syscall(__NR_unshare, CLONE_NEWNS | CLONE_NEWUSER);
+static bool warm;  // Whether `unzip_dir` is known to be extracted already.
 
-    // Map to root in the new namespace.
-    fo = fopen("/proc/self/uid_map", "w");
-    fprintf(fo, "0 %d 1\n", uid);
-    fclose(fo);
-    fo = fopen("/proc/self/setgroups", "w");
-    fprintf(fo, "deny");
-    fclose(fo);
-    fo = fopen("/proc/self/gid_map", "w");
-    fprintf(fo, "0 %d 1", gid);
-    fclose(fo);
+void process_package_structure() {
+  /*
+      Determines files in the zip object store & their metadata.
+      Makes sure only expected files are present, or errors out.
+      Unless the package was already extracted & stamped; then we only need its
+      name.
+  */
+
+  struct Zipos* zip = __zipos_get();  // 🦛
+
+  // Only where `extract_tree` would trust the stamp too; the rest look at
+  // the destination's files regardless.
+  if ((unzip == 'u' || unzip == 's') && !make_index &&
+      (name = find_package_name())) {
+    set_unzip_dir();
+    char* dir = tidy_mode == 'n' ? persist_dir : unzip_dir;
+    int lock = lock_sidecar(dir, LOCK_SH);  // Not while it's being extracted.
+    warm = stamp_matches(dir);
+    if (lock != -1) {
+      close(lock);
+    }
+    if (warm) {
+      return;
+    }
+  }
+
+  // Stored files can be copied straight out of the executable; which is
+  // read front to back, from the first file extracted (see `order_entries`).
+  archive_fd = open(GetProgramExecutableName(), O_RDONLY | O_CLOEXEC);
+  if (archive_fd != -1) {
+    posix_fadvise(archive_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  if (!make_index && load_index()) {
+    return;
+  }
+
+  // Paths are no longer than their names in the central directory, so it's
+  // an upper bound on all of them.
+  entries =
+      malloc(sizeof(struct Entry) * MAX(1, GetZipCdirRecords(zip->cdir)));
+  paths = malloc(GetZipCdirSize(zip->cdir) + 1);
+  n_entries = 0;
+  uint32_t paths_size = 0;
+  size_t suffix_size = strlen(APP_SUFFIX);
+
+  for (uint64_t i = 0, record_offset = GetZipCdirOffset(zip->cdir);
+       i < GetZipCdirRecords(zip->cdir);
+       i++, record_offset += ZIP_CFILE_HDRSIZE(zip->map + record_offset)) {
+    const uint8_t* cfile = zip->map + record_offset;
+    const char* file = ZIP_CFILE_NAME(cfile);
+    size_t file_size = ZIP_CFILE_NAMESIZE(cfile);
+
+    // Allow & ignore some PUISNE specific stuff:
+    if (is_puisne_file(file, file_size)) {
+      continue;
+    }
+
+    // Whatever's before the first slash is in the root level, & everything
+    // after it is the app-relative path.
+    const char* slash = memchr(file, '/', file_size);
+    if (!slash) {
+      fprintf(stderr, "PUISNE: Additional file `%.*s` in top level!\n",
+              (int)file_size, file);
+      exit(1);
+    }
+    size_t top_size = slash - file;
+
+    // App folder has to end with the suffix.
+    if (top_size < suffix_size ||
+        memcmp(slash - suffix_size, APP_SUFFIX, suffix_size)) {
+      fprintf(stderr, "PUISNE: Problematic top-level folder `%.*s`!\n",
+              (int)top_size, file);
+      exit(1);
+    }
+
+    // Disallow no-name app folder.
+    size_t name_size = top_size - suffix_size;
+    if (!name_size) {
+      fprintf(stderr, "PUISNE: Invalid app folder `%s`!\n", APP_SUFFIX);
+      exit(1);
+    }
+
+    // We either just learned our app's name for the first time, or need to
+    // confirm it hasn't changed (ie. we have multiple .app/ folders).
+    if (name) {
+      if (strlen(name) != name_size ||
+          memcmp(name, file, name_size)) {  // Three's a crowd.
+        fprintf(stderr, "PUISNE: Found multiple top level app folders!\n");
+        exit(1);
+      }
+    } else {
+      name = xstrndup(file, name_size);  // Nice to meet you.
+    }
+
+    size_t path_size = file_size - top_size - 1;
+    if (!path_size) {  // The app folder itself.
+      continue;
+    }
+
+    // Get metadata too:
+    struct timespec modified_time;
+    GetZipCfileTimestamps(cfile, &modified_time, NULL, NULL,
+                          has_utc_timestamp(cfile) ? 0 : get_time_offset());
+    bool is_dir = slash[path_size] == '/';
+
+    entries[n_entries++] = (struct Entry){
+        .record = record_offset,
+        .offset = GetZipCfileOffset(cfile),
+        .compressed_size = GetZipCfileCompressedSize(cfile),
+        .size = GetZipCfileUncompressedSize(cfile),
+        .mtime = modified_time.tv_sec,
+        .path = paths_size,
+        .path_size = path_size,
+        .crc = ZIP_CFILE_CRC32(cfile),
+        .mode = (GetZipCfileMode(cfile) & 07777) | (is_dir ? S_IFDIR : S_IFREG),
+        .method = ZIP_CFILE_COMPRESSIONMETHOD(cfile),
+    };
+    memcpy(paths + paths_size, slash + 1, path_size);
+    paths_size += path_size;
+    paths[paths_size++] = '\0';
+  }
+
+  if (!name) {  // If we found nothing...
+    print_empty();
+  }
+}
+
+void write_all(int fd, const void* data, size_t size, char* local_file) {
+  /*
+      Writes all of `data` or errors out.
+  */
+
+  ssize_t count;
+  while (size) {
+    count = write(fd, data, size);
+    if (count <= 0) {
+      fprintf(stderr, "PUISNE: Write error extracting `%s`.\n", local_file);
+      exit(1);
+    }
+    data = (const char*)data + count;
+    size -= count;
+  }
+}
+
+void put_le(uint8_t* p, uint64_t value, int size) {
+  for (int i = 0; i < size; i++) {
+    p[i] = value >> (i * 8);
+  }
+}
+
+int compare_entry_paths(const void* a, const void* b) {
+  return strcmp(paths + ((const struct Entry*)a)->path,
+                paths + ((const struct Entry*)b)->path);
+}
+
+void write_index(void) {
+  /*
+      Rewrites the PUISNE with `puisne/index.bin` (see `load_index`) made from
+      the entries just read; replacing any index from before.
+      The archive content is kept as-is; a local file for the index is written
+      where the central directory was, which follows it, with the index first.
+      So everything else keeps its offset, except the central directory
+      records, which all move by the same amount. ZIP64 end records are kept,
+      or added if the archive outgrows the classic one.
+  */
+
+  struct Zipos* zip = __zipos_get();
+  const char* executable = GetProgramExecutableName();
+  uint64_t cdir_offset = GetZipCdirOffset(zip->cdir);
+  size_t name_size = strlen(INDEX_FILE);
+
+  // Index content depends on the layout of the new central directory, which
+  // depends only on the index's size; so work that out first.
+  size_t paths_size = 0;
+  for (int i = 0; i < n_entries; i++) {
+    paths_size += entries[i].path_size + 1;
+  }
+  size_t size = sizeof(struct IndexHeader) + sizeof(struct Entry) * n_entries +
+                paths_size + strlen(name) + 1;
+  size_t pad = (8 - (cdir_offset + kZipLfileHdrMinSize + name_size) % 8) % 8;
+  size_t extra_size = pad && pad < kZipExtraHdrSize ? pad + 8 : pad;
+  size_t lfile_size = kZipLfileHdrMinSize + name_size + extra_size + size;
+  bool far = cdir_offset >= 0xffffffff;  // ie. its record needs ZIP64 extra.
+  size_t cfile_size = kZipCfileHdrMinSize + name_size + (far ? 12 : 0);
+  uint64_t new_cdir_offset = cdir_offset + lfile_size;
+
+  uint8_t* lfile = calloc(1, lfile_size);
+  struct IndexHeader* header = (struct IndexHeader*)(lfile + lfile_size - size);
+  struct Entry* index_entries = (struct Entry*)(header + 1);
+  char* index_paths = (char*)(index_entries + n_entries);
+
+  // Copy the central directory, but for any old index, noting where records
+  // are now.
+  uint8_t* cdir = malloc(cfile_size + GetZipCdirSize(zip->cdir));
+  size_t cdir_size = cfile_size;
+  uint64_t cdir_records = 1;
+  int k = 0;
+  for (uint64_t i = 0, record_offset = cdir_offset;
+       i < GetZipCdirRecords(zip->cdir);
+       i++, record_offset += ZIP_CFILE_HDRSIZE(zip->map + record_offset)) {
+    const uint8_t* cfile = zip->map + record_offset;
+    if (ZIP_CFILE_NAMESIZE(cfile) == name_size &&
+        !memcmp(ZIP_CFILE_NAME(cfile), INDEX_FILE, name_size)) {
+      continue;
+    }
+    if (k < n_entries && entries[k].record == record_offset) {
+      entries[k++].record = new_cdir_offset + cdir_size;
+    }
+    memcpy(cdir + cdir_size, cfile, ZIP_CFILE_HDRSIZE(cfile));
+    cdir_size += ZIP_CFILE_HDRSIZE(cfile);
+    cdir_records++;
+  }
+
+  // Sorted entries, with their paths in the same order, & the name last.
+  memcpy(index_entries, entries, sizeof(struct Entry) * n_entries);
+  qsort(index_entries, n_entries, sizeof(struct Entry), compare_entry_paths);
+  uint32_t offset = 0;
+  for (int i = 0; i < n_entries; i++) {
+    memcpy(index_paths + offset, paths + index_entries[i].path,
+           index_entries[i].path_size + 1);
+    index_entries[i].path = offset;
+    offset += index_entries[i].path_size + 1;
+  }
+  strcpy(index_paths + offset, name);
+  memcpy(header->magic, INDEX_MAGIC, 8);
+  header->cdir_offset = new_cdir_offset;
+  header->cdir_size = cdir_size;
+  header->cdir_records = cdir_records;
+  header->n_entries = n_entries;
+  header->paths_size = paths_size + strlen(name) + 1;
+  header->name = offset;
+  uint32_t crc = crc32(0, (const uint8_t*)header, size);
+
+  // Local file header, stored, dated 1980-01-01; its extra field only pads.
+  put_le(lfile, kZipLfileHdrMagic, 4);
+  put_le(lfile + 4, 10, 2);
+  put_le(lfile + 12, 0x21, 2);
+  put_le(lfile + 14, crc, 4);
+  put_le(lfile + 18, size, 4);
+  put_le(lfile + 22, size, 4);
+  put_le(lfile + 26, name_size, 2);
+  put_le(lfile + 28, extra_size, 2);
+  memcpy(lfile + kZipLfileHdrMinSize, INDEX_FILE, name_size);
+  if (extra_size) {
+    uint8_t* extra = lfile + kZipLfileHdrMinSize + name_size;
+    put_le(extra, INDEX_ALIGN, 2);
+    put_le(extra + 2, extra_size - kZipExtraHdrSize, 2);
+  }
+
+  // & its central directory record, made on Unix, a regular 0644 file.
+  memset(cdir, 0, cfile_size);
+  put_le(cdir, kZipCfileHdrMagic, 4);
+  put_le(cdir + 4, 3 << 8 | 20, 2);
+  put_le(cdir + 6, far ? 45 : 10, 2);
+  put_le(cdir + 14, 0x21, 2);
+  put_le(cdir + 16, crc, 4);
+  put_le(cdir + 20, size, 4);
+  put_le(cdir + 24, size, 4);
+  put_le(cdir + 28, name_size, 2);
+  put_le(cdir + 38, (uint64_t)(S_IFREG | 0644) << 16, 4);
+  put_le(cdir + 42, MIN(cdir_offset, 0xffffffff), 4);
+  memcpy(cdir + kZipCfileHdrMinSize, INDEX_FILE, name_size);
+  if (far) {
+    uint8_t* extra = cdir + kZipCfileHdrMinSize + name_size;
+    put_le(cdir + 30, 12, 2);
+    put_le(extra, kZipExtraZip64, 2);
+    put_le(extra + 2, 8, 2);
+    put_le(extra + 4, cdir_offset, 8);
+  }
+
+  // The end of central directory record, but with its new whereabouts; after
+  // a ZIP64 one (& its locator) if the archive had one, or now needs one.
+  const uint8_t* old_eocd = zip->cdir;
+  bool zip64 = ZIP_CDIR_MAGIC(old_eocd) == kZipCdir64HdrMagic;
+  if (zip64) {  // The classic record is still there, after the locator.
+    old_eocd += READ64LE(old_eocd + 4) + 12 + kZipCdir64LocatorSize;
+  }
+  zip64 = zip64 || cdir_records >= 0xffff || cdir_size >= 0xffffffff ||
+          new_cdir_offset >= 0xffffffff;
+  size_t old_eocd_size = kZipCdirHdrMinSize + ZIP_CDIR_COMMENTSIZE(old_eocd);
+  size_t eocd_size =
+      (zip64 ? kZipCdir64HdrMinSize + kZipCdir64LocatorSize : 0) +
+      old_eocd_size;
+  uint8_t* eocd = calloc(1, eocd_size);
+  uint8_t* p = eocd;
+  if (zip64) {
+    put_le(p, kZipCdir64HdrMagic, 4);
+    put_le(p + 4, kZipCdir64HdrMinSize - 12, 8);
+    put_le(p + 12, 3 << 8 | 45, 2);
+    put_le(p + 14, 45, 2);
+    put_le(p + 24, cdir_records, 8);
+    put_le(p + 32, cdir_records, 8);
+    put_le(p + 40, cdir_size, 8);
+    put_le(p + 48, new_cdir_offset, 8);
+    p += kZipCdir64HdrMinSize;
+    put_le(p, kZipCdir64LocatorMagic, 4);
+    put_le(p + 8, new_cdir_offset + cdir_size, 8);
+    put_le(p + 16, 1, 4);
+    p += kZipCdir64LocatorSize;
+  }
+  memcpy(p, old_eocd, old_eocd_size);
+  put_le(p + 8, MIN(cdir_records, 0xffff), 2);
+  put_le(p + 10, MIN(cdir_records, 0xffff), 2);
+  put_le(p + 12, MIN(cdir_size, 0xffffffff), 4);
+  put_le(p + 16, MIN(new_cdir_offset, 0xffffffff), 4);
+
+  char* temp_path = xstrcat(executable, ".XXXXXX");
+  int fd = mkstemp(temp_path);
+  struct stat st;
+  if (fd == -1 || fstat(archive_fd, &st) || fchmod(fd, st.st_mode & 07777)) {
+    fprintf(stderr, "PUISNE: Couldn't write index `%s`!\n", temp_path);
+    exit(1);
+  }
+  write_all(fd, zip->map, cdir_offset, temp_path);
+  write_all(fd, lfile, lfile_size, temp_path);
+  write_all(fd, cdir, cdir_size, temp_path);
+  write_all(fd, eocd, eocd_size, temp_path);
+  if (close(fd) || rename(temp_path, executable)) {
+    fprintf(stderr, "PUISNE: Couldn't replace `%s`!\n", executable);
+    unlink(temp_path);
+    exit(1);
+  }
+  fprintf(stderr, "PUISNE: Indexed %d entries of `%s`.\n", n_entries,
+          executable);
+
+  free(temp_path);
+  free(eocd);
+  free(cdir);
+  free(lfile);
+}
+
+static bool no_copy_file_range;  // Set once the kernel declines these,
+static bool no_sendfile;         //   so we stop asking.
+
+void copy_from_archive(int fd, int64_t offset, size_t size, char* local_file) {
+  /*
+      Copies `size` bytes at `offset` in the PUISNE into `fd`; used for files
+      stored without compression. Preferably the kernel does this without
+      bringing the data into user space at all; otherwise write straight from
+      the zipOS map, in one go.
+  */
+
+  ssize_t count;
+  while (size && !no_copy_file_range && archive_fd != -1) {
+    count = copy_file_range(archive_fd, &offset, fd, 0, size, 0);
+    if (count <= 0) {  // eg. ENOSYS, or EXDEV for older kernels.
+      no_copy_file_range = TRUE;
+      break;
+    }
+    size -= count;
+  }
+  while (size && !no_sendfile && archive_fd != -1) {
+    count = sendfile(fd, archive_fd, &offset, size);
+    if (count <= 0) {
+      no_sendfile = TRUE;
+      break;
+    }
+    size -= count;
+  }
+
+  write_all(fd, __zipos_get()->map + offset, size, local_file);
+}
+
+void inflate_from_archive(int fd, const uint8_t* data, size_t compressed_size,
+                          size_t size, char* local_file) {
+  /*
+      Inflates a deflated file straight out of the zipOS map into `fd`, in
+      chunks of up to `INFLATE_BUFSIZ`; fed to zlib at most 4 GiB at a time,
+      as much as it takes at once.
+  */
+
+  size_t buffer_size = MAX(1, MIN(size, INFLATE_BUFSIZ));
+  unsigned char* buffer = malloc(buffer_size);
+
+  z_stream zs = {0};
+  if (!buffer || inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+    fprintf(stderr, "PUISNE: Couldn't inflate `%s`!\n", local_file);
+    exit(1);
+  }
+  zs.next_in = (unsigned char*)data;
+
+  int rc;
+  do {
+    if (!zs.avail_in) {
+      zs.avail_in = MIN(compressed_size, UINT_MAX);
+      compressed_size -= zs.avail_in;
+    }
+    zs.next_out = buffer;
+    zs.avail_out = buffer_size;
+    rc = inflate(&zs, Z_NO_FLUSH);
+    if (rc != Z_OK && rc != Z_STREAM_END) {
+      fprintf(stderr, "PUISNE: Zip error reading file `%s`!\n", local_file);
+      exit(1);
+    }
+    write_all(fd, buffer, buffer_size - zs.avail_out, local_file);
+  } while (rc != Z_STREAM_END);
+
+  inflateEnd(&zs);
+  free(buffer);
+}
+
+void unzstd_from_archive(int fd, const uint8_t* data, size_t compressed_size,
+                         size_t size, char* local_file) {
+  /*
+      As `inflate_from_archive`, for zstd (method 93); also straight out of
+      the map, in chunks of up to `INFLATE_BUFSIZ`.
+  */
+
+  size_t buffer_size = MAX(1, MIN(size, INFLATE_BUFSIZ));
+  unsigned char* buffer = malloc(buffer_size);
+
+  ZSTD_DStream* zs = ZSTD_createDStream();
+  if (!buffer || !zs) {
+    fprintf(stderr, "PUISNE: Couldn't decompress `%s`!\n", local_file);
+    exit(1);
+  }
+  ZSTD_inBuffer in = {data, compressed_size, 0};
+
+  size_t rc;
+  do {
+    ZSTD_outBuffer out = {buffer, buffer_size, 0};
+    rc = ZSTD_decompressStream(zs, &out, &in);
+    if (ZSTD_isError(rc) ||
+        (rc && in.pos == in.size && out.pos < out.size)) {  // ie. truncated
+      fprintf(stderr, "PUISNE: Zip error reading file `%s`!\n", local_file);
+      exit(1);
+    }
+    write_all(fd, buffer, out.pos, local_file);
+  } while (rc || in.pos < in.size);  // ie. until the last frame's done.
+
+  ZSTD_freeDStream(zs);
+  free(buffer);
+}
+
+#define FALLOCATE_MIN (1024 * 1024)  // Size from which files are preallocated.
+
+static bool no_tmpfile;  // Set once `O_TMPFILE`s can't be made, or linked
+                         //   into place.
+
+char* temp_name(const char* file) {
+  /*
+      Name to write `file` under until it's done, beside it; per process, so
+      concurrent PUISNEs don't clash, & left over only if we crashed.
+  */
+
+  const char* base = strrchr(file, '/');
+  base = base ? base + 1 : file;
+  return xasprintf("%.*s.%s.%d.puisne", (int)(base - file), file, base,
+                   getpid());
+}
+
+int create_file(int dir_fd, const char* file, size_t size, char** temp) {
+  /*
+      Opens a file to write `file`'s content (of `size` bytes) into, which
+      no one sees until `publish_file` puts it in place, all at once. On
+      Linux, that's an unnamed `O_TMPFILE`, so nothing's left behind if we
+      don't get that far; else, `temp` is set to a name beside `file`.
+      Large files are preallocated, so they're laid out contiguously if the
+      filesystem can.
+  */
+
+  int fd = -1;
+  *temp = 0;
+  if (IsLinux() && !no_tmpfile) {
+    char* dir = dir_fd == AT_FDCWD ? xdirname(file) : xstrdup(".");
+    fd = openat(dir_fd, dir, O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+    free(dir);
+    if (fd == -1 && (errno == EOPNOTSUPP || errno == EISDIR)) {  // ie. unknown
+      no_tmpfile = TRUE;                                         //   to Linux.
+    }
+  }
+  if (fd == -1) {  // Not every filesystem does.
+    *temp = temp_name(file);
+    fd = openat(dir_fd, *temp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  }
+  if (fd != -1 && size >= FALLOCATE_MIN) {
+    fallocate(fd, 0, 0, size);  // Just a hint; fine if it can't.
+  }
+  return fd;
+}
+
+void publish_file(int fd, int dir_fd, const char* file, char* temp,
+                  char* local_file) {
+  /*
+      Puts the file written to `fd` (per `create_file`) in place as `file`,
+      replacing whatever was there; readers see either, but never a file
+      half-written. Frees `temp`; the caller closes `fd`.
+  */
+
+  bool ok;
+  if (temp) {
+    ok = !renameat(dir_fd, temp, dir_fd, file);
+  } else {
+    char* proc = xasprintf("/proc/self/fd/%d", fd);
+    ok = !linkat(AT_FDCWD, proc, dir_fd, file, AT_SYMLINK_FOLLOW);
+    if (!ok && errno == EEXIST) {  // Link aside, then replace it.
+      temp = temp_name(file);
+      unlinkat(dir_fd, temp, 0);
+      ok = !linkat(AT_FDCWD, proc, dir_fd, temp, AT_SYMLINK_FOLLOW) &&
+           !renameat(dir_fd, temp, dir_fd, file);
+    } else if (!ok) {  // eg. no `/proc`; so copy it out, & stop trying.
+      no_tmpfile = TRUE;
+      temp = temp_name(file);
+      int copy =
+          openat(dir_fd, temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+      struct stat st;
+      off_t offset = 0;
+      ok = copy != -1 && !fstat(fd, &st) && !fchmod(copy, st.st_mode & 07777);
+      while (ok && offset < st.st_size) {
+        ok = sendfile(copy, fd, &offset, st.st_size - offset) > 0;
+      }
+      ok = copy != -1 && !close(copy) && ok &&
+           !renameat(dir_fd, temp, dir_fd, file);
+    }
+    free(proc);
+  }
+  if (!ok) {
+    fprintf(stderr, "PUISNE: Write error extracting `%s`.\n", local_file);
+    exit(1);
+  }
+  free(temp);
+}
+
+void discard_file(int fd, int dir_fd, char* temp) {
+  /*
+      Abandons a file made by `create_file`.
+  */
+
+  close(fd);
+  if (temp) {
+    unlinkat(dir_fd, temp, 0);
+    free(temp);
+  }
+}
+
+void extract_file(int i, int dir_fd, const char* file) {
+  /*
+      Extract a single file, ie. `file` relative to `dir_fd` (see `file_at`).
+      Directories are made beforehand; see `extract_tree`.
+      Content comes directly from the zipOS map, as located by the central
+      directory record found in `process_package_structure`, into a file that
+      replaces any already there only once it's complete (see `create_file`).
+  */
+
+  struct Zipos* zip = __zipos_get();
+  struct Entry* e = entries + i;
+  const uint8_t* lfile = zip->map + e->offset;
+
+  char* temp;
+  int fd = create_file(dir_fd, file, e->size, &temp);
+  if (fd == -1) {
+    fprintf(stderr, "PUISNE: Write error extracting `%s`.\n", entry_path(i));
+    exit(1);
+  }
+
+  switch (e->method) {
+    case kZipCompressionNone:
+      copy_from_archive(fd, ZIP_LFILE_CONTENT(lfile) - zip->map, e->size,
+                        entry_path(i));
+      break;
+    case kZipCompressionDeflate:
+      inflate_from_archive(fd, ZIP_LFILE_CONTENT(lfile), e->compressed_size,
+                           e->size, entry_path(i));
+      break;
+    case kZipCompressionZstd:
+      unzstd_from_archive(fd, ZIP_LFILE_CONTENT(lfile), e->compressed_size,
+                          e->size, entry_path(i));
+      break;
+    default:
+      fprintf(stderr, "PUISNE: Unsupported compression for `%s`!\n",
+              entry_path(i));
+      exit(1);
+  }
+
+  fchmod(fd, e->mode & 07777);
+  publish_file(fd, dir_fd, file, temp, entry_path(i));
+  close(fd);
+}
+
+struct ParallelTask {
+  void (*task)(int);  // Called once per index,
+  int n;              //   for each of [0, n)...
+  int next;           //   as claimed by whichever thread is free.
+};
+
+void* parallel_worker(void* arg) {
+  /*
+      Claims & runs tasks until there are none left.
+  */
+
+  struct ParallelTask* pt = arg;
+  for (int i;
+       (i = __atomic_fetch_add(&pt->next, 1, __ATOMIC_RELAXED)) < pt->n;) {
+    pt->task(i);
+  }
+  return 0;
+}
+
+void parallel_for(int n, void (*task)(int)) {
+  /*
+      Runs `task(i)` for every `i` in [0, n), spread over up to `jobs` threads
+      (the calling thread included). Returns once all are done.
+  */
+
+  struct ParallelTask pt = {task, n, 0};
+  int n_threads = MIN(jobs, n) - 1;
+  pthread_t* threads = malloc(sizeof(pthread_t) * MAX(1, n_threads));
+
+  int t = 0;
+  for (; t < n_threads; t++) {
+    if (pthread_create(threads + t, 0, parallel_worker, &pt)) {
+      break;  // Fine; whoever's already running will pick up the slack.
+    }
+  }
+  parallel_worker(&pt);
+  while (t--) {
+    pthread_join(threads[t], 0);
+  }
+  free(threads);
+}
+
+// A minimal io_uring (see linux/io_uring.h), set up with raw syscalls; just
+// enough to batch the many small calls of extracting small files.
+#define NR_io_uring_setup    425  // The same on every architecture.
+#define NR_io_uring_enter    426
+#define NR_io_uring_register 427
+#define URING_OFF_SQ_RING    0
+#define URING_OFF_CQ_RING    0x8000000
+#define URING_OFF_SQES       0x10000000
+#define URING_FEAT_SINGLE_MMAP 1
+#define URING_ENTER_GETEVENTS  1
+#define URING_REGISTER_PROBE   8
+#define URING_OP_SUPPORTED     1
+#define URING_OP_OPENAT        18
+#define URING_OP_CLOSE         19
+#define URING_OP_STATX         21
+#define URING_OP_WRITE         23
+#define URING_BATCH     32           // Files per batch, ie. per round trip,
+#define URING_MAX_SIZE  (64 * 1024)  //   each at most this big.
+#ifndef STATX_CTIME
+#define STATX_CTIME 0x80
+#endif
+
+struct UringParams {
+  uint32_t sq_entries, cq_entries, flags, sq_thread_cpu, sq_thread_idle;
+  uint32_t features, wq_fd, resv[3];
+  struct {
+    uint32_t head, tail, ring_mask, ring_entries, flags, dropped, array, resv1;
+    uint64_t resv2;
+  } sq_off;
+  struct {
+    uint32_t head, tail, ring_mask, ring_entries, overflow, cqes, flags, resv1;
+    uint64_t resv2;
+  } cq_off;
+};
+struct UringSqe {
+  uint8_t opcode, flags;
+  uint16_t ioprio;
+  int32_t fd;
+  uint64_t off;    // Or, for statx, the buffer.
+  uint64_t addr;   // Buffer or path.
+  uint32_t len;    // Or mode, for openat, or mask, for statx.
+  uint32_t op_flags;
+  uint64_t user_data;
+  uint64_t pad[3];
+};
+struct UringCqe {
+  uint64_t user_data;
+  int32_t res;
+  uint32_t flags;
+};
+struct UringProbe {
+  uint8_t last_op, ops_len;
+  uint16_t resv;
+  uint32_t resv2[3];
+  struct {
+    uint8_t op, resv;
+    uint16_t flags;
+    uint32_t resv2;
+  } ops[256];
+};
+struct UringStatx {  // Of `struct statx`, only the ctime is of interest.
+  uint8_t head[96];
+  int64_t ctime;
+  uint32_t ctime_nsec;
+  uint8_t tail[148];
+};
+
+struct Uring {  // A ring, & what one thread needs to use it (see `take_uring`):
+  int fd;
+  int busy;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct UringSqe* sqes;
+  struct UringCqe* cqes;
+  void* sq_map;
+  void* cq_map;
+  size_t sq_map_size, cq_map_size;
+  unsigned char* buffer;  // INFLATE_BUFSIZ, for content or statx results.
+  ZSTD_DCtx* zstd;        // Made as needed, for zstd content.
+};
+static struct Uring* urings;  // One per thread, made as needed; if at all,
+static bool use_uring;        //   per `start_urings`.
+
+bool setup_uring(struct Uring* r) {
+  /*
+      Makes a ring of `URING_BATCH` entries & maps it in.
+  */
+
+  struct UringParams params = {0};
+  r->fd = syscall(NR_io_uring_setup, URING_BATCH, &params);
+  if (r->fd < 0) {
+    r->fd = -1;
+    return FALSE;
+  }
+
+  r->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r->cq_map_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct UringCqe);
+  if (params.features & URING_FEAT_SINGLE_MMAP) {
+    r->sq_map_size = r->cq_map_size = MAX(r->sq_map_size, r->cq_map_size);
+  }
+  r->sq_map = mmap(0, r->sq_map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, URING_OFF_SQ_RING);
+  r->cq_map = params.features & URING_FEAT_SINGLE_MMAP
+                  ? r->sq_map
+                  : mmap(0, r->cq_map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd, URING_OFF_CQ_RING);
+  r->sqes = mmap(0, params.sq_entries * sizeof(struct UringSqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                 URING_OFF_SQES);
+  r->buffer = malloc(INFLATE_BUFSIZ);
+  if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED ||
+      r->sqes == MAP_FAILED || !r->buffer) {
+    close(r->fd);  // The leftovers are few; not worth unmapping.
+    r->fd = -1;
+    return FALSE;
+  }
+
+  unsigned char* sq = r->sq_map;
+  unsigned char* cq = r->cq_map;
+  r->sq_head = (unsigned*)(sq + params.sq_off.head);
+  r->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  r->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  r->sq_array = (unsigned*)(sq + params.sq_off.array);
+  r->cq_head = (unsigned*)(cq + params.cq_off.head);
+  r->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  r->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  r->cqes = (struct UringCqe*)(cq + params.cq_off.cqes);
+  return TRUE;
+}
+
+bool start_urings(void) {
+  /*
+      Whether io_uring is to hand, with every operation batches need (ie.
+      since Linux 5.6, & unless eg. seccomp forbids it); if so, sets up a
+      ring for each of `jobs` threads to take.
+  */
+
+  if (!IsLinux()) {
+    return FALSE;
+  }
+  urings = calloc(jobs, sizeof(struct Uring));
+  for (int t = 0; t < jobs; t++) {
+    urings[t].fd = -2;  // ie. not yet set up.
+  }
+
+  struct UringProbe* probe = calloc(1, sizeof(struct UringProbe));
+  bool ok = setup_uring(urings) &&
+            !syscall(NR_io_uring_register, urings->fd, URING_REGISTER_PROBE,
+                     probe, 256);
+  int ops[] = {URING_OP_OPENAT, URING_OP_CLOSE, URING_OP_STATX,
+               URING_OP_WRITE};
+  for (int k = 0; ok && k < ARRAYLEN(ops); k++) {
+    ok = ops[k] <= probe->last_op &&
+         probe->ops[ops[k]].flags & URING_OP_SUPPORTED;
+  }
+  free(probe);
+
+  if (!ok) {
+    if (urings->fd >= 0) {
+      close(urings->fd);
+    }
+    free(urings);
+    urings = 0;
+  }
+  return ok;
+}
+
+void stop_urings(void) {
+  if (!urings) {
+    return;
+  }
+  for (int t = 0; t < jobs; t++) {
+    if (urings[t].fd >= 0) {
+      munmap(urings[t].sqes, URING_BATCH * sizeof(struct UringSqe));
+      if (urings[t].cq_map != urings[t].sq_map) {
+        munmap(urings[t].cq_map, urings[t].cq_map_size);
+      }
+      munmap(urings[t].sq_map, urings[t].sq_map_size);
+      close(urings[t].fd);
+      free(urings[t].buffer);
+    }
+    ZSTD_freeDCtx(urings[t].zstd);
+  }
+  free(urings);
+  urings = 0;
+}
+
+struct Uring* take_uring(void) {
+  /*
+      Claims a ring no other thread is using, setting it up if need be; or 0
+      if it can't be. Give it back with `give_uring`.
+  */
+
+  for (int t = 0; t < jobs; t++) {
+    int idle = 0;
+    if (__atomic_compare_exchange_n(&urings[t].busy, &idle, 1, FALSE,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      if (urings[t].fd == -2) {
+        setup_uring(urings + t);
+      }
+      if (urings[t].fd >= 0) {
+        return urings + t;
+      }
+      __atomic_store_n(&urings[t].busy, 0, __ATOMIC_RELEASE);
+    }
+  }
+  return 0;
+}
+
+void give_uring(struct Uring* r) {
+  if (r) {
+    __atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+  }
+}
+
+struct UringSqe* uring_sqe(struct Uring* r, int k) {
+  /*
+      The `k`th submission of the next `run_uring`, cleared for filling in.
+  */
+
+  unsigned slot = (*r->sq_tail + k) & *r->sq_mask;
+  struct UringSqe* sqe = r->sqes + slot;
+  memset(sqe, 0, sizeof(struct UringSqe));
+  sqe->user_data = k;
+  r->sq_array[slot] = slot;
+  return sqe;
+}
+
+void run_uring(struct Uring* r, int n, int* results) {
+  /*
+      Submits the `n` operations filled in by `uring_sqe` & waits for them
+      all, setting `results[k]` to what the `k`th returned (ie. -errno on
+      failure). Each round trip is a single syscall, however many there are.
+  */
+
+  if (!n) {
+    return;
+  }
+  __atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE);
+
+  int to_submit = n;
+  for (int done = 0; done < n;) {
+    int rc = syscall(NR_io_uring_enter, r->fd, to_submit, n - done,
+                     URING_ENTER_GETEVENTS, 0, 0);
+    if (rc < 0 && errno != EINTR) {
+      fprintf(stderr, "PUISNE: io_uring failed!\n");
+      exit(1);
+    } else if (rc > 0) {
+      to_submit -= MIN(rc, to_submit);
+    }
+
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, done++) {
+      struct UringCqe* cqe = r->cqes + (head & *r->cq_mask);
+      results[cqe->user_data] = cqe->res;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+
+struct TreeNode {        // A file or directory in the app folder:
+  const char* name;      //   last path component (NUL-terminated for files),
+  int name_size;         //   its length,
+  int parent;            //   index of the containing directory,
+  int child, sibling;    //   first of its own & next of the parent's content,
+  int file;              //   index in `entries`, if not an implied directory,
+  int mode;
+  int64_t cache_offset;  //   & where, if inflated, it is in `lazy_cache_fd`.
+};
+static struct TreeNode* tree_nodes;  // Parents before children; for `-u lazy`
+static int n_tree_nodes;             //   indexed by FUSE node ID - 1.
+static int* file_nodes;  // Node of each of `entries`.
+static int* tree_table;  // Hash table of node indices, by parent & name.
+static int tree_table_size;
+
+unsigned tree_hash(int parent, const char* name, int name_size) {
+  unsigned h = parent * 0x9e3779b1;
+  for (int i = 0; i < name_size; i++) {
+    h = (h ^ (unsigned char)name[i]) * 0x01000193;
+  }
+  return h;
+}
+
+int tree_find(int parent, const char* name, int name_size) {
+  /*
+      Index of the node called `name` in directory `parent`, or -1.
+  */
+
+  unsigned mask = tree_table_size - 1;
+  for (unsigned h = tree_hash(parent, name, name_size) & mask;
+       tree_table[h] != -1; h = (h + 1) & mask) {
+    struct TreeNode* node = tree_nodes + tree_table[h];
+    if (node->parent == parent && node->name_size == name_size &&
+        !memcmp(node->name, name, name_size)) {
+      return tree_table[h];
+    }
+  }
+  return -1;
+}
+
+int tree_add(int parent, const char* name, int name_size) {
+  /*
+      Finds or adds node `name` in directory `parent`; returns its index.
+  */
+
+  int found = tree_find(parent, name, name_size);
+  if (found != -1) {
+    return found;
+  }
+
+  unsigned mask = tree_table_size - 1;
+  unsigned h = tree_hash(parent, name, name_size) & mask;
+  while (tree_table[h] != -1) {
+    h = (h + 1) & mask;
+  }
+  tree_table[h] = n_tree_nodes;
+
+  struct TreeNode* node = tree_nodes + n_tree_nodes;
+  *node = (struct TreeNode){name, name_size, parent, -1, -1, -1,
+                            S_IFDIR | 0755, -1};
+  node->sibling = tree_nodes[parent].child;
+  tree_nodes[parent].child = n_tree_nodes;
+  return n_tree_nodes++;
+}
+
+void build_tree(void) {
+  /*
+      Arranges `entries` into a tree of nodes, including directories that are
+      only implied by the paths of files.
+  */
+
+  // Can't have more nodes than path components, nor more of those than
+  // slashes in the names, plus one per file & the root.
+  int capacity = 1;
+  for (int i = 0; i < n_entries; i++) {
+    for (const char* c = entry_path(i); *c; c++) {
+      capacity += *c == '/';
+    }
+    capacity++;
+  }
+  tree_nodes = malloc(sizeof(struct TreeNode) * capacity);
+  file_nodes = malloc(sizeof(int) * MAX(1, n_entries));
+  for (tree_table_size = 16; tree_table_size < capacity * 2;) {
+    tree_table_size *= 2;
+  }
+  tree_table = malloc(sizeof(int) * tree_table_size);
+  memset(tree_table, -1, sizeof(int) * tree_table_size);
+
+  tree_nodes[0] = (struct TreeNode){"", 0, 0, -1, -1, -1, S_IFDIR | 0755, -1};
+  n_tree_nodes = 1;
+
+  for (int i = 0; i < n_entries; i++) {
+    int node = 0;
+    for (const char *c = entry_path(i), *slash; *c; c = slash + 1) {
+      if (!(slash = strchr(c, '/'))) {
+        slash = c + strlen(c) - 1;  // Last component, of a file.
+        node = tree_add(node, c, slash - c + 1);
+        break;
+      }
+      node = tree_add(node, c, slash - c);
+    }
+    tree_nodes[node].file = i;
+    file_nodes[i] = node;
+    tree_nodes[node].mode = entries[i].mode;
+  }
+}
+
+#define DIR_MISSING -1  // Per `open_dirs`, a directory that doesn't exist
+#define DIR_BY_PATH -2  //   (yet), or couldn't be opened, eg. for want of fds.
+#define FDS_ASSUMED 1024  // Fds we may have open, if RLIMIT_NOFILE isn't known.
+
+static int dir_fd_budget;  // How many more directories may be held open.
+
+char* tree_path(const char* dir, int node) {
+  /*
+      Path of `node` beneath `dir`.
+  */
+
+  if (!node) {
+    return xstrdup(dir);
+  }
+  char* parent = tree_path(dir, tree_nodes[node].parent);
+  char* path = xasprintf("%s/%.*s", parent, tree_nodes[node].name_size,
+                         tree_nodes[node].name);
+  free(parent);
+  return path;
+}
+
+int open_dir_at(int* fds, const char* dir, int node, bool create) {
+  /*
+      Opens directory `node` beneath `dir`, relative to its parent's entry in
+      `fds`; first making it, if `create`. Until its parent can be opened, it
+      is `DIR_MISSING` or `DIR_BY_PATH` likewise.
+  */
+
+  struct TreeNode* n = tree_nodes + node;
+  int parent_fd = fds[n->parent];
+  if (parent_fd == DIR_BY_PATH) {
+    if (create) {
+      char* path = tree_path(dir, node);
+      makedirs(path, n->mode & 07777);
+      free(path);
+    }
+    return DIR_BY_PATH;
+  } else if (parent_fd == DIR_MISSING) {
+    return DIR_MISSING;
+  }
+
+  char* name = xstrndup(n->name, n->name_size);
+  if (create) {
+    mkdirat(parent_fd, name, n->mode & 07777);  // Fine if it already exists.
+  }
+  int fd = -1;
+  if (dir_fd_budget > 0) {
+    fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  } else {
+    errno = EMFILE;
+  }
+  free(name);
+  if (fd != -1) {
+    dir_fd_budget--;
+    return fd;
+  }
+  return !create && errno == ENOENT ? DIR_MISSING : DIR_BY_PATH;  // eg. EMFILE
+}
+
+int* open_dirs(const char* dir) {
+  /*
+      Opens whichever directories of the tree already exist beneath `dir`.
+      Parents come before their children, so one pass in order does it.
+  */
+
+  int* fds = malloc(sizeof(int) * n_tree_nodes);
+  fds[0] = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fds[0] == -1) {
+    fds[0] = errno == ENOENT ? DIR_MISSING : DIR_BY_PATH;
+  }
+  for (int node = 1; node < n_tree_nodes; node++) {
+    fds[node] = S_ISDIR(tree_nodes[node].mode)
+                    ? open_dir_at(fds, dir, node, FALSE)
+                    : DIR_MISSING;
+  }
+  return fds;
+}
+
+void close_dirs(int* fds) {
+  for (int node = 0; node < n_tree_nodes; node++) {
+    if (fds[node] >= 0) {
+      close(fds[node]);
+      dir_fd_budget++;
+    }
+  }
+  free(fds);
+}
+
+int file_at(int* fds, const char* dir, int i, char** file) {
+  /*
+      Locates `entries[i]` beneath `dir` for the `*at` calls: returns the fd of
+      its directory per `fds` & sets `file` to its name therein. Or, if that
+      directory is `DIR_BY_PATH`, `AT_FDCWD` & the whole path, which the caller
+      frees.
+  */
+
+  struct TreeNode* n = tree_nodes + file_nodes[i];
+  if (fds[n->parent] == DIR_BY_PATH) {
+    *file = xjoinpaths(dir, entry_path(i));
+    return AT_FDCWD;
+  }
+  *file = (char*)n->name;
+  return fds[n->parent];
+}
+
+static char* target_dir;  // Where `extract_tree` is extracting to,
+static char target_rule;  //   per which `-u` rule,
+static int* target_fds;   //   its directories there, per `open_dirs`,
+static bool* selected;    //   & which of `entries` are to be extracted.
+static bool* startup;     // With `-b`, which of them to extract first.
+static int* source_fds;   // Directories of the cache, for `materialize_file`.
+
+struct ManifestEntry {  // What `-u sync` last extracted:
+  char* file;           //   app-relative path,
+  uint32_t crc;         //   CRC32
+  uint64_t size;        //   & uncompressed size per the central directory.
+};
+static struct ManifestEntry* manifest;
+static int n_manifest;
+
+int compare_manifest_entries(const void* a, const void* b) {
+  return strcmp(((const struct ManifestEntry*)a)->file,
+                ((const struct ManifestEntry*)b)->file);
+}
+
+void load_manifest(void) {
+  /*
+      Reads the manifest left by the last `-u sync`, if any, ie. lines of
+      `crc32 size file`. Sorted for lookup by `manifest_matches`.
+  */
+
+  char* path = sidecar_path(target_dir, "manifest");
+  FILE* fi = fopen(path, "r");
+  free(path);
+  if (!fi) {
+    return;
+  }
+
+  int capacity = 0;
+  char line[PATH_MAX + 32];
+  unsigned crc;
+  unsigned long long size;
+  int k;
+  while (fgets(line, sizeof(line), fi)) {
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "%x %llu %n", &crc, &size, &k) != 2) {
+      continue;
+    }
+    if (n_manifest == capacity) {
+      capacity = MAX(64, capacity * 2);
+      manifest = realloc(manifest, sizeof(struct ManifestEntry) * capacity);
+    }
+    manifest[n_manifest++] =
+        (struct ManifestEntry){xstrdup(line + k), crc, size};
+  }
+  fclose(fi);
+
+  qsort(manifest, n_manifest, sizeof(struct ManifestEntry),
+        compare_manifest_entries);
+}
+
+bool manifest_matches(int i) {
+  /*
+      Whether `entries[i]` is as it was when last extracted by `-u sync`.
+  */
+
+  if (S_ISDIR(entries[i].mode)) {  // Directories have no content to compare.
+    return TRUE;
+  }
+
+  struct ManifestEntry key = {entry_path(i)};
+  struct ManifestEntry* found =
+      bsearch(&key, manifest, n_manifest, sizeof(struct ManifestEntry),
+              compare_manifest_entries);
+  return found && found->crc == entries[i].crc &&
+         found->size == entries[i].size;
+}
+
+void write_manifest(void) {
+  /*
+      Records the content just synced to `target_dir`, for the next `-u sync`.
+      Written aside & renamed into place, so it's never half-baked.
+  */
+
+  char* path = sidecar_path(target_dir, "manifest");
+  char* temp_path = xstrcat(path, ".tmp");
+  FILE* fo = fopen(temp_path, "w");
+  if (!fo) {
+    fprintf(stderr, "PUISNE: Couldn't write manifest `%s`!\n", path);
+    free(temp_path);
+    free(path);
+    return;
+  }
+
+  for (int i = 0; i < n_entries; i++) {
+    if (S_ISDIR(entries[i].mode)) {
+      continue;
+    }
+    fprintf(fo, "%08x %llu %s\n", entries[i].crc,
+            (unsigned long long)entries[i].size, entry_path(i));
+  }
+
+  if (fclose(fo) || rename(temp_path, path)) {
+    fprintf(stderr, "PUISNE: Couldn't write manifest `%s`!\n", path);
+    unlink(temp_path);
+  }
+  free(temp_path);
+  free(path);
+}
+
+bool should_extract(int i, bool exists, int64_t ctime) {
+  /*
+      Applies the `-u` rules to a single file, given whether it `exists`
+      already, & if so, its `ctime`.
+  */
+
+  if (exists) {
+    switch (target_rule) {
+      case 'n':
+        return FALSE;
+      case 'u':
+        // u & f are equivalent here...
+      case 'f':
+        if (ctime > entries[i].mtime) {
+          return FALSE;
+        }
+        break;
+      case 's':  // Only if the content in the archive changed.
+        if (manifest_matches(i)) {
+          return FALSE;
+        }
+    }
+  } else {  // It don't.
+    switch (target_rule) {
+      case 'f':
+        // f & e are equivalent here...
+      case 'e':
+        return FALSE;
+    }
+  }
+
+  // If we made it this far, we must want this file!
+  return TRUE;
+}
+
+bool content_matches(int i, int dir_fd, const char* file) {
+  /*
+      For `-u verify`, whether `file` (relative to `dir_fd`) is `entries[i]`
+      as in the archive, ie. has the same size & CRC32 (which zlib computes
+      with whatever the CPU has for it, eg. PCLMUL).
+  */
+
+  int fd = openat(dir_fd, file, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  bool matches = fd != -1 && !fstat(fd, &st) && S_ISREG(st.st_mode) &&
+                 st.st_size == entries[i].size;
+  if (matches && st.st_size) {
+    unsigned char* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    matches = data != MAP_FAILED;
+    if (matches) {
+      uLong crc = crc32(0, 0, 0);
+      for (size_t done = 0; done < st.st_size;) {  // In chunks `uInt` can take.
+        uInt chunk = MIN(st.st_size - done, 1 << 30);
+        crc = crc32(crc, data + done, chunk);
+        done += chunk;
+      }
+      matches = crc == entries[i].crc;
+      munmap(data, st.st_size);
+    }
+  } else if (matches) {
+    matches = !entries[i].crc;
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  return matches;
+}
+
+void select_file(int i) {
+  /*
+      Decides whether `entries[i]` is to be extracted.
+      Directories only ever need making, so the rules that create nothing
+      don't bother with them.
+  */
+
+  if (S_ISDIR(entries[i].mode)) {
+    selected[i] = target_rule != 'e' && target_rule != 'f';
+    return;
+  } else if (target_rule == 'a') {  // Brute-force is always simple...
+    selected[i] = TRUE;
+    return;
+  }
+
+  // More selective extraction logic:
+  char* file;
+  int dir_fd = file_at(target_fds, target_dir, i, &file);
+  if (target_rule == 'v') {  // Whatever's missing, or isn't as it should be.
+    selected[i] = dir_fd == DIR_MISSING || !content_matches(i, dir_fd, file);
+  } else {
+    struct stat st;
+    bool exists = dir_fd != DIR_MISSING && !fstatat(dir_fd, file, &st, 0);
+    selected[i] = should_extract(i, exists, exists ? st.st_ctim.tv_sec : 0);
+  }
+  if (dir_fd == AT_FDCWD) {
+    free(file);
+  }
+}
+
+void select_batch(int batch) {
+  /*
+      `select_file` for each of a batch of `URING_BATCH` entries, with their
+      `stat`s all made at once via io_uring.
+  */
+
+  int first = batch * URING_BATCH;
+  int last = MIN(first + URING_BATCH, n_entries);
+  struct Uring* r = take_uring();
+  struct UringStatx* statxes = r ? (struct UringStatx*)r->buffer : 0;
+  int files[URING_BATCH];
+  int results[URING_BATCH];
+
+  int n = 0;
+  for (int i = first; i < last; i++) {
+    int dir_fd = target_fds[tree_nodes[file_nodes[i]].parent];
+    if (!r || S_ISDIR(entries[i].mode) || dir_fd < 0) {  // eg. DIR_MISSING
+      select_file(i);
+      continue;
+    }
+    struct UringSqe* sqe = uring_sqe(r, n);
+    sqe->opcode = URING_OP_STATX;
+    sqe->fd = dir_fd;
+    sqe->addr = (uintptr_t)tree_nodes[file_nodes[i]].name;
+    sqe->len = STATX_CTIME;
+    sqe->off = (uintptr_t)(statxes + n);
+    files[n++] = i;
+  }
+  run_uring(r, n, results);
+  give_uring(r);
+
+  for (int k = 0; k < n; k++) {
+    selected[files[k]] = should_extract(files[k], !results[k],
+                                        results[k] ? 0 : statxes[k].ctime);
+  }
+}
+
+static void (*target_write)(int, int,
+                            const char*);  // How `extract_tree` writes files.
+
+#define READAHEAD_SIZE (16 * 1024 * 1024)  // Of the archive, ahead of writing.
+
+static int* extract_order;      // `entries` by where they are in the archive,
+static uint64_t readahead_end;  //   & how far it's been advised (per
+                                //   `read_ahead`).
+
+int compare_entry_offsets(const void* a, const void* b) {
+  uint64_t x = entries[*(const int*)a].offset;
+  uint64_t y = entries[*(const int*)b].offset;
+  return (x > y) - (x < y);
+}
+
+void order_entries(void) {
+  /*
+      Sorts `extract_order` by local file header offset, so files are written
+      in the order they're read from the archive, front to back; kindest to
+      spinning disks & network filesystems. Usually it's central directory
+      order anyway, unless eg. `zip -g` has since replaced some.
+  */
+
+  if (extract_order) {
+    return;
+  }
+  extract_order = malloc(sizeof(int) * MAX(1, n_entries));
+  bool sorted = TRUE;
+  for (int i = 0; i < n_entries; i++) {
+    extract_order[i] = i;
+    sorted = sorted && (!i || entries[i - 1].offset <= entries[i].offset);
+  }
+  if (!sorted) {
+    qsort(extract_order, n_entries, sizeof(int), compare_entry_offsets);
+  }
+}
+
+void read_ahead(int k) {
+  /*
+      Once writing is up to `extract_order[k]`, advises the kernel of what's
+      next in the archive: `READAHEAD_SIZE` past it, whenever less than half
+      that is left. So it's read sequentially, in big chunks & while earlier
+      files are still being written, rather than faulted in page by page.
+  */
+
+  struct Zipos* zip = __zipos_get();
+  struct Entry* e = entries + extract_order[k];
+  uint64_t limit = GetZipCdirOffset(zip->cdir);  // ie. the end of content.
+  uint64_t end = MIN(e->offset + e->compressed_size + READAHEAD_SIZE, limit);
+  uint64_t from = __atomic_load_n(&readahead_end, __ATOMIC_RELAXED);
+  if (from >= MIN(end - READAHEAD_SIZE / 2, limit) ||
+      !__atomic_compare_exchange_n(&readahead_end, &from, end, FALSE,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    return;  // Far enough along already; or another thread's seeing to it.
+  }
+  uintptr_t start = (uintptr_t)(zip->map + MAX(from, e->offset)) &
+                    -(uintptr_t)getpagesize();
+  madvise((void*)start, (uintptr_t)(zip->map + end) - start, MADV_WILLNEED);
+}
+
+void extract_selected_file(int i) {
+  /*
+      Extracts `entries[i]` if it was selected; directories are already made.
+  */
+
+  if (selected[i] && !S_ISDIR(entries[i].mode)) {
+    int64_t t = trace_clock();
+    char* file;
+    int dir_fd = file_at(target_fds, target_dir, i, &file);
+    target_write(i, dir_fd, file);
+    if (dir_fd == AT_FDCWD) {
+      free(file);
+    }
+    trace_file("file", entry_path(i), t);
+  }
+}
+
+void extract_ordered_file(int k) {
+  /*
+      `extract_selected_file` for `extract_order[k]`, reading ahead of it.
+  */
+
+  int i = extract_order[k];
+  if (selected[i] && target_write == extract_file) {
+    read_ahead(k);
+  }
+  extract_selected_file(i);
+}
+
+void extract_selected_batch(int batch) {
+  /*
+      `extract_selected_file` for each of a batch of `URING_BATCH` entries,
+      via io_uring: small files are made (as `O_TMPFILE`s), written & closed
+      all at once, in three round trips; only publishing each one (see
+      `publish_file`) is a call apiece. Their content is written straight
+      from the zipOS map, or decompressed beforehand, & they're made with
+      their mode to begin with (hence `umask(0)` in `extract_tree`). Whatever
+      else is extracted as usual.
+  */
+
+  int first = batch * URING_BATCH;  // Of `extract_order`.
+  int last = MIN(first + URING_BATCH, n_entries);
+  struct Uring* r = take_uring();
+  struct Zipos* zip = __zipos_get();
+  int files[URING_BATCH];
+  int fds[URING_BATCH];
+  int results[URING_BATCH];
+  const unsigned char* content[URING_BATCH];
+  size_t used = 0;  // Of `r->buffer`, by files inflated.
+
+  int64_t t = trace_clock();
+  read_ahead(first);
+  int n = 0;
+  for (int k = first; k < last; k++) {
+    int i = extract_order[k];
+    struct Entry* e = entries + i;
+    if (!selected[i] || S_ISDIR(e->mode)) {
+      continue;
+    }
+    int dir_fd = target_fds[tree_nodes[file_nodes[i]].parent];
+    const uint8_t* data = ZIP_LFILE_CONTENT(zip->map + e->offset);
+    if (!r || no_tmpfile || dir_fd < 0 || e->size > URING_MAX_SIZE) {
+      extract_selected_file(i);
+      continue;
+    } else if (e->method == kZipCompressionNone) {
+      content[n] = data;
+    } else if (e->method == kZipCompressionDeflate &&
+               used + e->size <= INFLATE_BUFSIZ) {
+      z_stream zs = {0};
+      zs.next_in = (unsigned char*)data;
+      zs.avail_in = e->compressed_size;
+      zs.next_out = r->buffer + used;
+      zs.avail_out = e->size;
+      bool ok = inflateInit2(&zs, -MAX_WBITS) == Z_OK &&
+                inflate(&zs, Z_FINISH) == Z_STREAM_END &&
+                zs.total_out == e->size;
+      inflateEnd(&zs);
+      if (!ok) {  // Let the usual way report it.
+        extract_selected_file(i);
+        continue;
+      }
+      content[n] = r->buffer + used;
+      used += e->size;
+    } else if (e->method == kZipCompressionZstd &&
+               used + e->size <= INFLATE_BUFSIZ &&
+               (r->zstd || (r->zstd = ZSTD_createDCtx())) &&
+               ZSTD_decompressDCtx(r->zstd, r->buffer + used, e->size, data,
+                                   e->compressed_size) == e->size) {
+      content[n] = r->buffer + used;
+      used += e->size;
+    } else {  // Including zstd errors; let the usual way report them.
+      extract_selected_file(i);
+      continue;
+    }
+
+    struct UringSqe* sqe = uring_sqe(r, n);
+    sqe->opcode = URING_OP_OPENAT;
+    sqe->fd = dir_fd;
+    sqe->addr = (uintptr_t)".";
+    sqe->len = e->mode & 07777;
+    sqe->op_flags = O_RDWR | O_TMPFILE | O_CLOEXEC;
+    files[n++] = i;
+  }
+  run_uring(r, n, results);
+
+  int m = 0;  // Opened, ie. now to write.
+  for (int k = 0; k < n; k++) {
+    if (results[k] < 0) {  // eg. EOPNOTSUPP
+      extract_selected_file(files[k]);
+      continue;
+    }
+    files[m] = files[k];
+    fds[m] = results[k];
+    content[m] = content[k];
+    struct UringSqe* sqe = uring_sqe(r, m);
+    sqe->opcode = URING_OP_WRITE;
+    sqe->fd = fds[m];
+    sqe->addr = (uintptr_t)content[m];
+    sqe->len = entries[files[m]].size;
+    m++;
+  }
+  run_uring(r, m, results);
+
+  for (int k = 0; k < m; k++) {
+    size_t size = entries[files[k]].size;
+    size_t written = MAX(0, results[k]);
+    if (written < size) {  // Short, or failed; finish (or fail) as usual.
+      write_all(fds[k], content[k] + written, size - written,
+                entry_path(files[k]));
+    }
+    publish_file(fds[k], target_fds[tree_nodes[file_nodes[files[k]]].parent],
+                 tree_nodes[file_nodes[files[k]]].name, 0,
+                 entry_path(files[k]));
+    struct UringSqe* sqe = uring_sqe(r, k);
+    sqe->opcode = URING_OP_CLOSE;
+    sqe->fd = fds[k];
+  }
+  run_uring(r, m, results);
+  give_uring(r);
+
+  for (int k = 0; k < m; k++) {
+    trace_file("file", entry_path(files[k]), t);
+  }
+}
+
+void extract_tree(char* dir, char rule,
+                  void (*write_file)(int, int, const char*)) {
+  /*
+      Extracts the package to `dir` per the `-u` rule given, writing each file
+      selected with `write_file`.
+      Work is spread over `jobs` threads in three passes: deciding what to
+      extract, making directories (serially, so threads never race to make the
+      same one), then writing files; having taken the lock on `dir`, so no
+      other PUISNE extracts there at once. Directories are held open, so
+      everything is made relative to its parent's fd rather than walking the
+      whole path again each time. Files are written in archive order, & so
+      claimed by threads, reading ahead (see `order_entries`). Where io_uring
+      is to hand, they're taken in batches, to save on syscalls (see
+      `use_uring`).
+  */
+
+  int64_t t = trace_clock();
+  target_dir = dir;
+  target_rule = rule;
+  target_write = write_file;
+
+  if (makedirs(target_dir, 0755)) {
+    fprintf(stderr, "PUISNE: Couldn't make app folder `%s`!\n", target_dir);
+    exit(1);
+  };
+  char* lock_path = sidecar_path(target_dir, "lock");
+  char* sidecar_dir = xdirname(lock_path);
+  makedirs(sidecar_dir, 0755);  // ie. `.puisne/`, for `-n`.
+  free(sidecar_dir);
+  free(lock_path);
+
+  // One at a time; & if whoever we waited for extracted the whole of this
+  // very archive, there's nothing left to do.
+  int lock = lock_sidecar(target_dir, LOCK_EX);
+  trace("extract_tree: lock", target_dir, t);
+  t = trace_clock();
+  if ((target_rule == 'u' || target_rule == 's') &&
+      stamp_matches(target_dir)) {
+    if (lock != -1) {
+      close(lock);
+    }
+    return;
+  }
+
+  // Until we're done, this is no longer the archive last extracted here.
+  cache_missed = cache_missed || (cache_dir && target_dir == unzip_dir);
+  char* stamp = sidecar_path(target_dir, "stamp");
+  unlink(stamp);
+  free(stamp);
+
+  if (target_rule == 's') {
+    load_manifest();
+  }
+
+  target_fds = open_dirs(target_dir);
+  selected = calloc(MAX(1, n_entries), sizeof(bool));
+  int n_batches = (n_entries + URING_BATCH - 1) / URING_BATCH;
+  if (use_uring && target_rule != 'a' && target_rule != 'v') {
+    parallel_for(n_batches, select_batch);
+  } else {
+    parallel_for(n_entries, select_file);
+  }
+
+  // With `-e`, the entrypoint needn't be on disk at all; unless it's a
+  // script. Though the cache is kept whole.
+  bool partial = memory_exec && target_dir == persist_dir &&
+                 find_entrypoint() && entrypoint_index >= 0 &&
+                 !entrypoint_is_script();
+  if (partial) {
+    selected[entrypoint_index] = FALSE;
+  }
+
+  // With `-b`, only what the app starts with, for now.
+  for (int i = 0; startup && i < n_entries; i++) {
+    selected[i] = selected[i] && startup[i];
+  }
+
+  // zipOS may explicitly include directories; if not, we might need to make
+  // them in advance: whichever are missing, & contain something selected.
+  char* needed = calloc(n_tree_nodes, 1);
+  for (int i = 0; i < n_entries; i++) {
+    if (!selected[i]) {
+      continue;
+    }
+    int node = file_nodes[i];
+    needed[node] = S_ISDIR(entries[i].mode);
+    for (node = tree_nodes[node].parent; node && !needed[node];
+         node = tree_nodes[node].parent) {
+      needed[node] = TRUE;
+    }
+  }
+  for (int node = 1; node < n_tree_nodes; node++) {
+    if (!needed[node]) {
+      continue;
+    }
+    if (target_fds[node] == DIR_MISSING) {
+      target_fds[node] = open_dir_at(target_fds, target_dir, node, TRUE);
+      stats.dirs++;
+    } else if (target_fds[node] == DIR_BY_PATH) {
+      char* path = tree_path(target_dir, node);
+      makedirs(path, tree_nodes[node].mode & 07777);
+      free(path);
+    }
+  }
+  free(needed);
+
+  trace("extract_tree: select & mkdir", target_dir, t);
+  t = trace_clock();
+  order_entries();
+  readahead_end = 0;
+  if (use_uring && target_write == extract_file) {
+    mode_t mask = umask(0);
+    parallel_for(n_batches, extract_selected_batch);
+    umask(mask);
+  } else {
+    parallel_for(n_entries, extract_ordered_file);
+  }
+  trace("extract_tree: write", target_dir, t);
+
+  for (int i = 0; i < n_entries; i++) {
+    if (S_ISDIR(entries[i].mode)) {
+      continue;
+    } else if (!selected[i]) {
+      stats.skipped++;
+      continue;
+    }
+    stats.extracted++;
+    stats.bytes_written += entries[i].size;
+    if (target_write == extract_file) {  // Rather than from the cache.
+      stats.bytes_read += entries[i].compressed_size;
+    }
+  }
+
+  if (target_rule == 's' && !startup) {
+    write_manifest();
+  }
+  if ((target_rule == 'a' || target_rule == 'u' || target_rule == 's' ||
+       target_rule == 'v') &&
+      !startup) {  // ie. the whole archive.
+    write_stamp(target_dir, partial);
+  }
+
+  if (lock != -1) {
+    close(lock);
+  }
+  close_dirs(target_fds);
+  free(selected);
+  for (int i = 0; i < n_manifest; i++) {
+    free(manifest[i].file);
+  }
+  free(manifest);
+  manifest = 0;
+  n_manifest = 0;
+}
+
+void materialize_file(int i, int dir_fd, const char* file) {
+  /*
+      Makes `file` (relative to `dir_fd`) from its copy in the cache (ie.
+      `unzip_dir`), sharing its blocks where the filesystem can; eg. a reflink
+      on btrfs or XFS, or a hard link with `-l hard` if the file is read-only
+      anyway. Otherwise, it's copied, or extracted anew.
+  */
+
+  char* cached_file;
+  int cached_fd = file_at(source_fds, unzip_dir, i, &cached_file);
+
+  if (link_mode == 'h' && !(entries[i].mode & 0222)) {
+    char* temp = temp_name(file);  // Linked aside, then replacing `file`.
+    unlinkat(dir_fd, temp, 0);
+    bool linked = !linkat(cached_fd, cached_file, dir_fd, temp, 0) &&
+                  !renameat(dir_fd, temp, dir_fd, file);
+    unlinkat(dir_fd, temp, 0);  // If `file` was already this very link.
+    free(temp);
+    if (linked) {
+      if (cached_fd == AT_FDCWD) {
+        free(cached_file);
+      }
+      return;
+    }
+  }
+
+  int fi = openat(cached_fd, cached_file, O_RDONLY | O_CLOEXEC);
+  if (cached_fd == AT_FDCWD) {
+    free(cached_file);
+  }
+  char* temp;
+  int fo = create_file(dir_fd, file, 0, &temp);  // Shared, not allocated.
+  if (fo == -1) {
+    fprintf(stderr, "PUISNE: Write error extracting `%s`.\n", entry_path(i));
+    exit(1);
+  }
+
+  size_t size = entries[i].size;
+  bool done = fi != -1 && !ioctl(fo, FICLONE, fi);
+  while (!done && fi != -1 && size) {  // The kernel may yet share, or copy.
+    ssize_t count = copy_file_range(fi, 0, fo, 0, size, 0);
+    if (count <= 0) {
+      break;
+    }
+    size -= count;
+    done = !size;
+  }
+  if (fi != -1) {
+    close(fi);
+  }
+  if (done) {
+    fchmod(fo, entries[i].mode & 07777);
+    publish_file(fo, dir_fd, file, temp, entry_path(i));
+    close(fo);
+  } else {
+    discard_file(fo, dir_fd, temp);
+    extract_file(i, dir_fd, file);
+  }
+}
+
+#define STARTUP_FILE "puisne/startup.list"
+
+int compare_strings(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+void load_startup(void) {
+  /*
+      Marks `startup`: the entrypoint, & whatever `puisne/startup.list` lists,
+      if the package has one; app-relative paths, one per line.
+  */
+
+  char** lines = 0;
+  int n_lines = 0;
+  int capacity = 0;
+  char line[PATH_MAX + 2];
+  FILE* fi = fopen("/zip/" STARTUP_FILE, "r");
+  while (fi && fgets(line, sizeof(line), fi)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!*line) {
+      continue;
+    }
+    if (n_lines == capacity) {
+      capacity = MAX(64, capacity * 2);
+      lines = realloc(lines, sizeof(char*) * capacity);
+    }
+    lines[n_lines++] = xstrdup(line);
+  }
+  if (fi) {
+    fclose(fi);
+  }
+  qsort(lines, n_lines, sizeof(char*), compare_strings);
+
+  startup = calloc(MAX(1, n_entries), sizeof(bool));
+  for (int i = 0; i < n_entries; i++) {
+    char* path = entry_path(i);
+    startup[i] = !strcmp(path, name) ||
+                 bsearch(&path, lines, n_lines, sizeof(char*), compare_strings);
+  }
+  for (int i = 0; i < n_lines; i++) {
+    free(lines[i]);
+  }
+  free(lines);
+}
+
+void extract_files(void) {
+  /*
+      Since the package in the object store checks out, extract the files to
+      wherever specified by `-d`.
+      This actually compares the timestamp in the zip object store & file
+      on-disk, and only extracts (/overwrites) if the zipOS is newer; this is
+      basically a way to cache (so you don't need to re-extract each run), or
+      to maintain user/runtime edits. The latter can be propogated to the
+      package itself via
+      ```sh
+      zip -d package.com package.app/\* \
+          && zip -r package.com "package.app"
+      ```
+      (`zip -FS` will remove additional PUISNE/Cosmopolitan files).
+      With `-c` & `-n`, the cache is filled first (if need be), then the
+      destination from it.
+  */
+
+  set_unzip_dir();
+  build_tree();
+
+  // Every directory is held open while extracting; allow as many as we may,
+  // but leave the app with the limit it'd have had. Where there's no limit
+  // to be had (eg. Windows), assume a modest one, & leave it be.
+  struct rlimit limit, raised = {FDS_ASSUMED, FDS_ASSUMED};
+  bool limited = !getrlimit(RLIMIT_NOFILE, &limit);
+  if (limited) {
+    raised = (struct rlimit){limit.rlim_max, limit.rlim_max};
+    if (setrlimit(RLIMIT_NOFILE, &raised) ||
+        getrlimit(RLIMIT_NOFILE, &raised)) {
+      raised = limit;
+    }
+  }
+  // Leave plenty for the files being written, a couple per thread, &c.
+  dir_fd_budget = MIN(raised.rlim_cur, INT_MAX) / 2 - 4 * jobs;
+  // Batches hold a whole lot open at once; so only if there are fds to spare
+  // (of the other half). The kernel runs much of a batch on its own threads,
+  // so alone on a single CPU it's no faster, if anything.
+  use_uring = jobs > 1 &&
+              MIN(raised.rlim_cur, INT_MAX) / 2 >= URING_BATCH * jobs &&
+              start_urings();
+
+  if (startup) {  // Straight from the archive, even with a cache; see `-b`.
+    extract_tree(persist_dir, unzip, extract_file);
+  } else if (tidy_mode == 'm' || unzip_dir == persist_dir) {
+    extract_tree(unzip_dir, unzip, extract_file);
+  } else {
+    if (unzip == 'v' || !stamp_matches(unzip_dir)) {
+      // The cache is ours, not the user's; so keep it whole.
+      extract_tree(unzip_dir,
+                   unzip == 'a' || unzip == 's' || unzip == 'v' ? unzip : 'u',
+                   extract_file);
+    }
+    source_fds = open_dirs(unzip_dir);
+    extract_tree(persist_dir, unzip, materialize_file);
+    close_dirs(source_fds);
+  }
+
+  stop_urings();
+  if (limited) {
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  free(tree_nodes);
+  free(tree_table);
+  free(file_nodes);
+
+  if (!indexed && !startup) {  // The rest is yet to be extracted.
+    free(entries);
+    free(paths);
+    entries = 0;  // eg. `find_entrypoint` then walks the central directory.
+    paths = 0;
+  }
+}
+
+// A minimal, read-only FUSE server for `-u lazy`; speaks just enough of the
+// kernel protocol (see linux/fuse.h) to serve the app folder from the archive.
+#define FUSE_LOOKUP       1
+#define FUSE_FORGET       2
+#define FUSE_GETATTR      3
+#define FUSE_OPEN         14
+#define FUSE_READ         15
+#define FUSE_STATFS       17
+#define FUSE_RELEASE      18
+#define FUSE_INIT         26
+#define FUSE_OPENDIR      27
+#define FUSE_READDIR      28
+#define FUSE_RELEASEDIR   29
+#define FUSE_INTERRUPT    36
+#define FUSE_DESTROY      38
+#define FUSE_BATCH_FORGET 42
+#define FUSE_ROOT_ID      1
+#define FUSE_KERNEL_MINOR 19
+#define FOPEN_KEEP_CACHE  2
+#define LAZY_TIMEOUT      86400  // Nothing changes; the kernel may cache all,
+#define LAZY_MAX_READ     (1024 * 1024)  //   & read a lot at once.
+
+struct FuseInHeader {
+  uint32_t len, opcode;
+  uint64_t unique, nodeid;
+  uint32_t uid, gid, pid;
+  uint16_t total_extlen, padding;
+};
+struct FuseOutHeader {
+  uint32_t len;
+  int32_t error;
+  uint64_t unique;
+};
+struct FuseAttr {
+  uint64_t ino, size, blocks, atime, mtime, ctime;
+  uint32_t atimensec, mtimensec, ctimensec, mode, nlink, uid, gid, rdev;
+  uint32_t blksize, flags;
+};
+struct FuseEntryOut {
+  uint64_t nodeid, generation, entry_valid, attr_valid;
+  uint32_t entry_valid_nsec, attr_valid_nsec;
+  struct FuseAttr attr;
+};
+struct FuseAttrOut {
+  uint64_t attr_valid;
+  uint32_t attr_valid_nsec, dummy;
+  struct FuseAttr attr;
+};
+struct FuseOpenOut {
+  uint64_t fh;
+  uint32_t open_flags, padding;
+};
+struct FuseReadIn {
+  uint64_t fh, offset;
+  uint32_t size, read_flags;
+};
+struct FuseInitIn {
+  uint32_t major, minor, max_readahead, flags;
+};
+struct FuseInitOut {  // As of 7.19.
+  uint32_t major, minor, max_readahead, flags;
+  uint16_t max_background, congestion_threshold;
+  uint32_t max_write;
+};
+struct FuseStatfsOut {
+  uint64_t blocks, bfree, bavail, files, ffree;
+  uint32_t bsize, namelen, frsize, padding, spare[6];
+};
+struct FuseDirent {
+  uint64_t ino, off;
+  uint32_t namelen, type;
+};
+
+static int lazy_cache_fd = -1;  // Where `-u lazy` inflates files to.
+
+void lazy_attr(int node, struct FuseAttr* attr) {
+  struct TreeNode* n = tree_nodes + node;
+  memset(attr, 0, sizeof(*attr));
+  attr->ino = node + FUSE_ROOT_ID;
+  attr->mode = n->mode;
+  attr->nlink = S_ISDIR(n->mode) ? 2 : 1;
+  attr->blksize = 4096;
+  if (n->file != -1) {
+    attr->mtime = attr->ctime = attr->atime = entries[n->file].mtime;
+    if (S_ISREG(n->mode)) {
+      attr->size = entries[n->file].size;
+      attr->blocks = (attr->size + 511) / 512;
+    }
+  }
+}
+
+void lazy_reply(int fuse_fd, uint64_t unique, int error, const void* data,
+                size_t size) {
+  struct FuseOutHeader out = {sizeof(out) + size, -error, unique};
+  struct iovec iov[2] = {{&out, sizeof(out)}, {(void*)data, size}};
+  writev(fuse_fd, iov, size ? 2 : 1);  // Nothing to do if the kernel balks.
+}
+
+int lazy_open(int node) {
+  /*
+      Makes a file readable: inflates it to `lazy_cache_fd` the first time.
+      Stored files are read directly from the map instead (see `serve_lazy`).
+  */
+
+  struct TreeNode* n = tree_nodes + node;
+  if (!S_ISREG(n->mode)) {
+    return EISDIR;
+  }
+
+  struct Entry* e = entries + n->file;
+  if (e->method == kZipCompressionNone) {
+    trace("lazy: open", entry_path(n->file), trace_clock());  // Every time.
+    return 0;
+  } else if (n->cache_offset != -1) {
+    return 0;
+  }
+  if (e->method != kZipCompressionDeflate &&
+      e->method != kZipCompressionZstd) {
+    return EIO;
+  }
+
+  int64_t t = trace_clock();
+  const uint8_t* data = ZIP_LFILE_CONTENT(__zipos_get()->map + e->offset);
+  n->cache_offset = lseek(lazy_cache_fd, 0, SEEK_END);
+  if (e->method == kZipCompressionZstd) {
+    unzstd_from_archive(lazy_cache_fd, data, e->compressed_size, e->size,
+                        entry_path(n->file));
+  } else {
+    inflate_from_archive(lazy_cache_fd, data, e->compressed_size, e->size,
+                         entry_path(n->file));
+  }
+  // Every file, in order of use.
+  trace("lazy: inflate", entry_path(n->file), t);
+  return 0;
+}
+
+void serve_lazy(int fuse_fd) {
+  /*
+      Serves FUSE requests (one at a time) until unmounted.
+  */
+
+  struct Zipos* zip = __zipos_get();
+  char* request = malloc(LAZY_MAX_READ + 4096);
+  char* reply = malloc(LAZY_MAX_READ);
+
+  for (;;) {
+    ssize_t count = read(fuse_fd, request, LAZY_MAX_READ + 4096);
+    if (count < (ssize_t)sizeof(struct FuseInHeader)) {
+      if (count == -1 && (errno == EINTR || errno == ENOENT)) {
+        continue;  // Interrupted, or the request was.
+      }
+      _Exit(0);  // ENODEV; unmounted.
+    }
+
+    struct FuseInHeader* in = (struct FuseInHeader*)request;
+    void* arg = request + sizeof(struct FuseInHeader);
+    int node = in->nodeid - FUSE_ROOT_ID;
+    if (in->opcode != FUSE_INIT &&
+        (node < 0 || node >= n_tree_nodes)) {  // Shouldn't happen.
+      lazy_reply(fuse_fd, in->unique, ENOENT, 0, 0);
+      continue;
+    }
+
+    switch (in->opcode) {
+      case FUSE_INIT: {
+        struct FuseInitIn* init = arg;
+        struct FuseInitOut out = {7, FUSE_KERNEL_MINOR, init->max_readahead};
+        out.max_write = 4096;
+        lazy_reply(fuse_fd, in->unique, 0, &out, sizeof(out));
+        break;
+      }
+      case FUSE_LOOKUP: {
+        const char* child_name = arg;
+        int child = tree_find(node, child_name, strlen(child_name));
+        if (child == -1) {
+          lazy_reply(fuse_fd, in->unique, ENOENT, 0, 0);
+          break;
+        }
+        struct FuseEntryOut out = {child + FUSE_ROOT_ID, 0, LAZY_TIMEOUT,
+                                   LAZY_TIMEOUT};
+        lazy_attr(child, &out.attr);
+        lazy_reply(fuse_fd, in->unique, 0, &out, sizeof(out));
+        break;
+      }
+      case FUSE_GETATTR: {
+        struct FuseAttrOut out = {LAZY_TIMEOUT};
+        lazy_attr(node, &out.attr);
+        lazy_reply(fuse_fd, in->unique, 0, &out, sizeof(out));
+        break;
+      }
+      case FUSE_OPEN: {
+        int error = lazy_open(node);
+        struct FuseOpenOut out = {0, FOPEN_KEEP_CACHE};
+        lazy_reply(fuse_fd, in->unique, error, &out, error ? 0 : sizeof(out));
+        break;
+      }
+      case FUSE_READ: {
+        struct FuseReadIn* read_in = arg;
+        struct Entry* e = entries + tree_nodes[node].file;
+        uint64_t offset = MIN(read_in->offset, e->size);
+        size_t length =
+            MIN(MIN(read_in->size, LAZY_MAX_READ), e->size - offset);
+        if (tree_nodes[node].cache_offset == -1) {  // Stored; straight out.
+          lazy_reply(fuse_fd, in->unique, 0,
+                     ZIP_LFILE_CONTENT(zip->map + e->offset) + offset, length);
+          break;
+        }
+        count = pread(lazy_cache_fd, reply, length,
+                      tree_nodes[node].cache_offset + offset);
+        lazy_reply(fuse_fd, in->unique, count < 0 ? EIO : 0, reply,
+                   MAX(0, count));
+        break;
+      }
+      case FUSE_READDIR: {
+        struct FuseReadIn* read_in = arg;
+        size_t size = 0;
+        int child = tree_nodes[node].child;
+        for (uint64_t off = 0;; off++) {  // ".", "..", then the content.
+          int entry;
+          const char* entry_name;
+          int entry_size;
+          if (off == 0) {
+            entry = node;
+            entry_name = ".";
+            entry_size = 1;
+          } else if (off == 1) {
+            entry = tree_nodes[node].parent;
+            entry_name = "..";
+            entry_size = 2;
+          } else if (child != -1) {
+            entry = child;
+            entry_name = tree_nodes[child].name;
+            entry_size = tree_nodes[child].name_size;
+            child = tree_nodes[child].sibling;
+          } else {
+            break;
+          }
+          if (off < read_in->offset) {
+            continue;
+          }
+
+          size_t record_size =
+              (sizeof(struct FuseDirent) + entry_size + 7) & ~(size_t)7;
+          if (size + record_size > MIN(read_in->size, LAZY_MAX_READ)) {
+            break;
+          }
+          struct FuseDirent dirent = {entry + FUSE_ROOT_ID, off + 1,
+                                      entry_size,
+                                      (tree_nodes[entry].mode & S_IFMT) >> 12};
+          memset(reply + size, 0, record_size);
+          memcpy(reply + size, &dirent, sizeof(dirent));
+          memcpy(reply + size + sizeof(dirent), entry_name, entry_size);
+          size += record_size;
+        }
+        lazy_reply(fuse_fd, in->unique, 0, reply, size);
+        break;
+      }
+      case FUSE_OPENDIR: {
+        struct FuseOpenOut out = {0};
+        lazy_reply(fuse_fd, in->unique,
+                   S_ISDIR(tree_nodes[node].mode) ? 0 : ENOTDIR, &out,
+                   S_ISDIR(tree_nodes[node].mode) ? sizeof(out) : 0);
+        break;
+      }
+      case FUSE_STATFS: {
+        struct FuseStatfsOut out = {0};
+        out.files = n_tree_nodes;
+        out.bsize = out.frsize = 4096;
+        out.namelen = 255;
+        lazy_reply(fuse_fd, in->unique, 0, &out, sizeof(out));
+        break;
+      }
+      case FUSE_RELEASE:
+      case FUSE_RELEASEDIR:
+        lazy_reply(fuse_fd, in->unique, 0, 0, 0);
+        break;
+      case FUSE_FORGET:  // Nodes live as long as we do; no reply expected.
+      case FUSE_BATCH_FORGET:
+      case FUSE_INTERRUPT:
+        break;
+      case FUSE_DESTROY:
+        _Exit(0);
+      default:  // No writes, links, xattrs &c.; the kernel stops asking.
+        lazy_reply(fuse_fd, in->unique, ENOSYS, 0, 0);
+    }
+  }
+}
+
+char* mount_lazy(void) {
+  /*
+      Mounts the app folder, served from the archive by a child process, at
+      `work_dir/lazy.mnt`; returns that path. Inflated files are cached in (an
+      unlinked) `work_dir/lazy.cache` for the life of the server, which is that
+      of the package.
+  */
+
+  char* lazy_dir = xjoinpaths(work_dir, "lazy.mnt");
+  char* cache_path = xjoinpaths(work_dir, "lazy.cache");
+  int fuse_fd = open("/dev/fuse", O_RDWR);
+  lazy_cache_fd = open(cache_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  unlink(cache_path);
+  free(cache_path);
+  if (fuse_fd == -1 || lazy_cache_fd == -1 || makedirs(lazy_dir, 0755)) {
+    fprintf(stderr, "PUISNE: Couldn't set up lazy mount!\n");
+    exit(1);
+  }
+
+  char* mount_data_string = xasprintf(
+      "fd=%d,rootmode=%o,user_id=0,group_id=0", fuse_fd, S_IFDIR | 0755);
+  int m = mount("puisne", lazy_dir, "fuse.puisne",
+                MS_NOSUID | MS_NODEV | MS_RDONLY, mount_data_string);
+  free(mount_data_string);
+  if (m) {
+    fprintf(stderr, "PUISNE: Lazy mount failed!\n");
+    exit(1);
+  }
+
+  build_tree();
+  int parent = getpid();
+  if (!fork()) {
+    // Go down with the package, whatever it's exec'd as.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent) {
+      _Exit(0);
+    }
+    serve_lazy(fuse_fd);
+  }
+  close(fuse_fd);
+  close(lazy_cache_fd);
+  return lazy_dir;
+}
+
+unsigned long long namespace_key(void) {
+  /*
+      Tells apart work dirs & namespaces kept by `-k`: FNV-1a of everything
+      that makes `mount_in_namespace` mount something different.
+  */
+
+  char* key = xasprintf("%s:%s:%s:%s:%s:%c%c%d", get_fingerprint(), name,
+                        invocation_dir, unzip_dir, persist_dir, overlay, unzip,
+                        getuid());
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  for (char* c = key; *c; c++) {
+    h = (h ^ (unsigned char)*c) * 0x100000001b3ULL;
+  }
+  free(key);
+  return h;
+}
+
+int lock_dir(const char* dir) {
+  /*
+      Opens & exclusively locks `dir`, if it's ours & no one else has; else -1.
+      The lock is kept open across `execv`, ie. held for as long as the app
+      (or anything it leaves running) is.
+  */
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+  struct stat st;
+  if (fd != -1 && (fstat(fd, &st) || st.st_uid != getuid() ||
+                   flock(fd, LOCK_EX | LOCK_NB))) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+void remove_tree(const char* path) {
+  /*
+      `rm -rf`, more or less; overlayfs leaves its `work` inaccessible.
+  */
+
+  struct stat st;
+  if (lstat(path, &st)) {
+    return;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    chmod(path, 0700);
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+    while (dir && (entry = readdir(dir))) {
+      if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+        char* child = xjoinpaths(path, entry->d_name);
+        remove_tree(child);
+        free(child);
+      }
+    }
+    if (dir) {
+      closedir(dir);
+    }
+    rmdir(path);
+  } else {
+    unlink(path);
+  }
+}
+
+#define WORK_USERS "users"  // In a work dir, pids of apps launched with it.
+
+bool work_dir_in_use(const char* dir) {
+  /*
+      Whether any process noted by `note_work_user` in `dir` is still alive,
+      ie. an app (or a `-k` launch that joined) still running on its mounts;
+      which its lock alone doesn't tell, as joining launches don't hold it, &
+      apps may well close fds they didn't open.
+  */
+
+  char* path = xjoinpaths(dir, WORK_USERS);
+  FILE* fi = fopen(path, "r");
+  free(path);
+  long pid;
+  bool in_use = FALSE;
+  while (fi && !in_use && fscanf(fi, "%ld", &pid) == 1) {
+    in_use = pid > 0 && (!kill(pid, 0) || errno == EPERM);
   }
+  if (fi) {
+    fclose(fi);
+  }
+  return in_use;
+}
+
+static char* work_users;  // `WORK_USERS` in the work dir (see `set_work_dir`).
+
+void note_work_user(pid_t pid) {
+  /*
+      Adds `pid` to the processes using the work dir (see `work_dir_in_use`),
+      dropping those gone since; written aside & renamed into place.
+  */
 
-  // Handle nestedness:
-  char real_lower_dir[PATH_MAX];
-  char real_upper_dir[PATH_MAX];
+  if (!work_users) {
+    return;
+  }
+  char* temp_path = xstrcat(work_users, ".tmp");
+  FILE* fi = fopen(work_users, "r");
+  FILE* fo = fopen(temp_path, "w");
+  long user;
+  while (fi && fo && fscanf(fi, "%ld", &user) == 1) {
+    if (user > 0 && user != pid && (!kill(user, 0) || errno == EPERM)) {
+      fprintf(fo, "%ld\n", user);
+    }
+  }
+  if (fi) {
+    fclose(fi);
+  }
+  if (!fo || fprintf(fo, "%ld\n", (long)pid) < 0 || fclose(fo) ||
+      rename(temp_path, work_users)) {
+    unlink(temp_path);
+  }
+  free(temp_path);
+}
 
-  if (_startswith(
-          realpath(lower_dir, real_lower_dir),
-          realpath(upper_dir, real_upper_dir))) {  // If lower_dir is a
-                                                   // subdirectory of upper_dir:
+void sweep_work_dirs(void) {
+  /*
+      Removes work dirs that launches long gone left behind, ie. any of ours
+      in the tempdir that no one holds the lock to (see `lock_dir`), & that
+      no app still uses (see `work_dir_in_use`).
+  */
 
-    // Make an intermediary directory within work_dir:
-    char* intermediate_mnt = xjoinpaths(work_dir, "inter.mnt");
-    char* intermediate_wrk = xjoinpaths(work_dir, "inter.wrk");
-    if (makedirs(intermediate_mnt, 0755)) {
-      fprintf(stderr, "PUISNE: Could not make intermediate directory %s!\n",
-              intermediate_mnt);
+  DIR* dir = opendir(kTmpPath);
+  struct dirent* entry;
+  while (dir && (entry = readdir(dir))) {
+    if (!_startswith(entry->d_name, "puisne.")) {
+      continue;
     }
-    if (makedirs(intermediate_wrk, 0755)) {
-      fprintf(stderr, "PUISNE: Could not make intermediate directory %s!\n",
-              intermediate_wrk);
+    char* path = xjoinpaths(kTmpPath, entry->d_name);
+    int fd = lock_dir(path);
+    if (fd != -1 && !work_dir_in_use(path)) {
+      remove_tree(path);
     }
+    if (fd != -1) {
+      close(fd);
+    }
+    free(path);
+  }
+  if (dir) {
+    closedir(dir);
+  }
+}
+
+static int work_lock = -1;  // Held while `work_dir` is in use.
+
+void set_work_dir(void) {
+  /*
+      Settles on `work_dir`: as given by `-w` (made from a template, if it
+      ends with "XXXXXX"), or by default, one reused by launches of the same
+      package from the same place, ie. `puisne.<uid>.<key>.<n>` in the tempdir
+      with the first `n` not in use: neither locked, nor with an app on it.
+      Making one anew, sweeps up after others.
+  */
 
-    // Mount an overlay there, to be used as an intermediate layer.
-    mount_data_string =
-        xstrcat("upperdir=", intermediate_mnt, ",lowerdir=", lower_dir,
-                ",workdir=", intermediate_wrk);
-    m = mount("overlay", intermediate_mnt, "overlay", 0, mount_data_string);
-    free(mount_data_string);
-    if (m) {
-      fprintf(stderr, "PUISNE: Intermediate mount failed!\n");
+  if (work_dir) {
+    if (_endswith(work_dir, "XXXXXX") ? !mkdtemp(work_dir)
+                                      : makedirs(work_dir, 0700)) {
+      fprintf(stderr, "PUISNE: Couldn't make work directory `%s`!\n",
+              work_dir);
       exit(1);
     }
+    work_lock = lock_dir(work_dir);
+    return;
+  }
 
-    // Update so the "real" overlay mount uses that:
-    lower_dir = intermediate_mnt;
-    work_dir = xjoinpaths(work_dir, "over.wrk");
-    makedirs(work_dir, 0755);
+  for (int n = 0; n < 16; n++) {  // ie. launches at once; plenty.
+    char* base =
+        xasprintf("puisne.%d.%016llx.%d", getuid(), namespace_key(), n);
+    char* dir = xjoinpaths(kTmpPath, base);
+    free(base);
+    bool made = !mkdir(dir, 0700);
+    if ((work_lock = lock_dir(dir)) != -1 && !work_dir_in_use(dir)) {
+      work_dir = dir;
+      work_users = xjoinpaths(work_dir, WORK_USERS);
+      note_work_user(getpid());  // ie. the app, once exec'd.
+      if (made) {
+        sweep_work_dirs();
+      }
+      return;
+    }
+    if (work_lock != -1) {  // Unlocked, but not done with.
+      close(work_lock);
+      work_lock = -1;
+    }
+    free(dir);
   }
 
-  mount_data_string = xstrcat("upperdir=", upper_dir, ",lowerdir=", lower_dir,
-                              ",workdir=", work_dir);
-  m = mount("overlay", invocation_dir, "overlay", 0, mount_data_string);
-  free(mount_data_string);
-  if (m) {
-    fprintf(stderr, "PUISNE: Overlay mount failed!\n");
+  work_dir = mkdtemp(xjoinpaths(kTmpPath, "puisne.XXXXXX"));
+  if (!work_dir) {
+    fprintf(stderr, "PUISNE: Couldn't make work directory!\n");
+    exit(1);
+  }
+  work_lock = lock_dir(work_dir);
+  sweep_work_dirs();
+}
+
+bool make_mount_point(const char* source, const char* target) {
+  /*
+      Makes `target` something `source` can be bind mounted on, ie. of the
+      same kind; or, if it's a symlink, copies it instead. Whether to mount.
+  */
+
+  struct stat st;
+  if (lstat(source, &st)) {
+    return FALSE;
+  }
+  if (S_ISLNK(st.st_mode)) {
+    char link[PATH_MAX];
+    ssize_t size = readlink(source, link, sizeof(link) - 1);
+    if (size >= 0) {
+      link[size] = '\0';
+      symlink(link, target);
+    }
+    return FALSE;
+  } else if (S_ISDIR(st.st_mode)) {
+    return !mkdir(target, 0755) || errno == EEXIST;
+  }
+  int fd = open(target, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd != -1) {
+    close(fd);
+  }
+  return fd != -1;
+}
+
+void bind_entries(const char* dir, const char* root, bool read_only) {
+  /*
+      Bind mounts each entry at the top of `dir` onto the same name in
+      `root`, unless there's one there already; `read_only`, if so.
+  */
+
+  DIR* d = opendir(dir);
+  struct dirent* entry;
+  while (d && (entry = readdir(d))) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+      continue;
+    }
+    char* source = xjoinpaths(dir, entry->d_name);
+    char* target = xjoinpaths(root, entry->d_name);
+    struct stat st;
+    if (lstat(target, &st) && make_mount_point(source, target) &&
+        (mount(source, target, 0, MS_BIND | MS_REC, 0) ||
+         (read_only && mount(0, target, 0, MS_REMOUNT | MS_BIND | MS_RDONLY,
+                             0)))) {
+      fprintf(stderr, "PUISNE: Bind mount of `%s` failed!\n", source);
+      exit(1);
+    }
+    free(source);
+    free(target);
+  }
+  if (d) {
+    closedir(d);
+  }
+}
+
+void mount_binds(const char* app_dir) {
+  /*
+      For `-o bind`, puts the app's files in place read-only, without any
+      overlay: the working environment is remade on a tmpfs in `work_dir`,
+      the app's entries bind mounted there, then those of the working
+      environment that don't clash, & the whole bind mounted over it. So the
+      app reads its files & the working environment's at the speed of the
+      filesystems they're on, & writes to the latter as usual; but it can't
+      make new ones alongside, nor write to its own.
+  */
+
+  char* root = xjoinpaths(work_dir, "bind");
+  makedirs(root, 0755);
+  if (mount("tmpfs", root, "tmpfs", 0, "mode=0755")) {
+    fprintf(stderr, "PUISNE: Couldn't mount tmpfs on `%s`!\n", root);
+    exit(1);
+  }
+  bind_entries(app_dir, root, TRUE);
+  bind_entries(invocation_dir, root, FALSE);
+  if (mount(0, root, 0, MS_REMOUNT | MS_RDONLY, "mode=0755") ||
+      mount(root, invocation_dir, 0, MS_BIND | MS_REC, 0)) {
+    fprintf(stderr, "PUISNE: Bind mount on `%s` failed!\n", invocation_dir);
     exit(1);
   }
+  free(root);
+}
+
+int mount_overlay(const char* target, const char* upper_dir,
+                  const char* lower_dir, const char* work_dir) {
+  /*
+      `mount -t overlay`; returns as `mount` does.
+  */
+
+  char* data = xstrcat("upperdir=", upper_dir, ",lowerdir=", lower_dir,
+                       ",workdir=", work_dir);
+  int m = mount("overlay", target, "overlay", 0, data);
+  free(data);
+  return m;
+}
+
+void mount_in_namespace(void) {
+  /*
+      If we're in Linux, use a mount namespace to overlay the extracted files
+      & the package's unzip_dir.
+  */
+
+  int uid = getuid();
+  int gid = getgid();
+
+  char* upper_dir;
+  char* lower_dir;
+
+  FILE* fo;
+
+  if (overlay == 'b') {  // See `mount_binds`.
+    upper_dir = lower_dir = 0;
+  } else if (overlay == 'o') {
+    upper_dir = persist_dir;
+    if (unzip_dir == persist_dir) {
+      lower_dir = invocation_dir;
+    } else {  // Cached; the app sees its files over the working environment.
+      lower_dir = xstrcat(unzip_dir, ':', invocation_dir);
+    }
+    makedirs(upper_dir, 0755);
+  } else {
+    upper_dir = invocation_dir;
+    lower_dir = unzip_dir;
+  }
+
+  set_work_dir();
+
+  int64_t t = trace_clock();
+  if (uid || gid) {  // If we aren't already root:
+    // Fake it 'til you make it.
+    if (syscall(__NR_unshare, CLONE_NEWNS | CLONE_NEWUSER)) {
+      fprintf(stderr, "PUISNE: Couldn't make a user namespace!\n");
+      exit(1);
+    }
+
+    // Map to root in the new namespace.
+    fo = fopen("/proc/self/uid_map", "w");
+    fprintf(fo, "0 %d 1\n", uid);
+    fclose(fo);
+    fo = fopen("/proc/self/setgroups", "w");
+    fprintf(fo, "deny");
+    fclose(fo);
+    fo = fopen("/proc/self/gid_map", "w");
+    fprintf(fo, "0 %d 1", gid);
+    fclose(fo);
+  } else if (unzip == 'l' || keep_seconds) {
+    // Keep the FUSE server's mount, or the kept namespace, to ourselves.
+    syscall(__NR_unshare, CLONE_NEWNS);
+    mount(0, "/", 0, MS_REC | MS_SLAVE, 0);
+  }
+
+  trace("mount: unshare", 0, t);
+
+  if (overlay == 'b') {
+    char* app_dir = unzip_dir;
+    if (unzip == 'l') {
+      t = trace_clock();
+      app_dir = mount_lazy();
+      trace("mount: lazy", app_dir, t);
+    }
+    t = trace_clock();
+    mount_binds(app_dir);
+    trace("mount: bind", invocation_dir, t);
+  } else {
+    // Handle nestedness:
+    char real_lower_dir[PATH_MAX];
+    char real_upper_dir[PATH_MAX];
+
+    if (unzip == 'l') {
+      // Nothing was extracted; the archive itself is the package's layer.
+      // It can't take writes, so in the "over" case persist_dir still does.
+      t = trace_clock();
+      char* lazy_dir = mount_lazy();
+      trace("mount: lazy", lazy_dir, t);
+      if (overlay == 'o') {
+        lower_dir = xstrcat(lazy_dir, ':', invocation_dir);
+      } else {
+        lower_dir = lazy_dir;
+      }
+    } else if (!strchr(lower_dir, ':') &&  // ie. not a stack of cache & all.
+               _startswith(
+                   realpath(lower_dir, real_lower_dir),
+                   realpath(upper_dir, real_upper_dir))) {  // If lower_dir is a
+                                                            // subdirectory of
+                                                            // upper_dir:
+
+      // Overlayfs refuses a lower layer within the upper (ELOOP), even by
+      // way of a bind mount; so another overlay goes in between.
+      // Make an intermediary directory within work_dir:
+      char* intermediate_mnt = xjoinpaths(work_dir, "inter.mnt");
+      char* intermediate_wrk = xjoinpaths(work_dir, "inter.wrk");
+      if (makedirs(intermediate_mnt, 0755)) {
+        fprintf(stderr, "PUISNE: Could not make intermediate directory %s!\n",
+                intermediate_mnt);
+      }
+      if (makedirs(intermediate_wrk, 0755)) {
+        fprintf(stderr, "PUISNE: Could not make intermediate directory %s!\n",
+                intermediate_wrk);
+      }
+
+      // Mount an overlay there, to be used as an intermediate layer.
+      t = trace_clock();
+      if (mount_overlay(intermediate_mnt, intermediate_mnt, lower_dir,
+                        intermediate_wrk)) {
+        fprintf(stderr, "PUISNE: Intermediate mount failed!\n");
+        exit(1);
+      }
+      trace("mount: intermediate overlay", intermediate_mnt, t);
+
+      // Update so the "real" overlay mount uses that:
+      lower_dir = intermediate_mnt;
+      work_dir = xjoinpaths(work_dir, "over.wrk");
+      makedirs(work_dir, 0755);
+    }
+
+    t = trace_clock();
+    if (mount_overlay(invocation_dir, upper_dir, lower_dir, work_dir)) {
+      fprintf(stderr, "PUISNE: Overlay mount failed!\n");
+      exit(1);
+    }
+    trace("mount: overlay", invocation_dir, t);
+  }
 
   if (uid || gid) {  // If we weren't already root:
     // unshare again to drop privilege:
@@ -633,57 +3623,406 @@ void mount_in_namespace(void) {
   chdir(getcwd(0, 0));
 }
 
+int namespace_socket(struct sockaddr_un* addr, uint32_t* addr_size) {
+  /*
+      A socket for the holder of a kept namespace, & its (abstract) address.
+  */
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  int size = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                      "puisne.%d.%016llx", getuid(), namespace_key());
+  *addr_size = offsetof(struct sockaddr_un, sun_path) + 1 + size;
+  return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+}
+
+bool join_namespace(void) {
+  /*
+      Joins the namespace kept (per `-k`) by an earlier launch, if any, rather
+      than making it all again. The holder is asked for its pid & waits while
+      we open its namespaces; then we enter them as `mount_in_namespace` made
+      them: the outer user namespace (which owns the mount namespace), the
+      mount namespace, then the inner user namespace (mapped back to us).
+  */
+
+  struct sockaddr_un addr;
+  uint32_t addr_size;
+  int sock = namespace_socket(&addr, &addr_size);
+  if (sock == -1 || connect(sock, (struct sockaddr*)&addr, addr_size)) {
+    if (sock != -1) {
+      close(sock);
+    }
+    return FALSE;
+  }
+
+  // Only trust a holder of our own; it's alive (so its pid is too) for as
+  // long as it waits on us.
+  struct ucred peer;
+  uint32_t peer_size = sizeof(peer);
+  char ready;
+  if (read(sock, &ready, 1) != 1 ||
+      getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) ||
+      peer.uid != getuid()) {
+    close(sock);
+    return FALSE;
+  }
+  char* user_path = xasprintf("/proc/%d/ns/user", peer.pid);
+  char* mnt_path = xasprintf("/proc/%d/ns/mnt", peer.pid);
+  int user_fd = open(user_path, O_RDONLY | O_CLOEXEC);
+  int mnt_fd = open(mnt_path, O_RDONLY | O_CLOEXEC);
+  free(user_path);
+  free(mnt_path);
+  close(sock);
+
+  bool rootless = getuid() || getgid();
+  int outer_fd = rootless && user_fd != -1 ? ioctl(user_fd, NS_GET_PARENT) : -1;
+  if (mnt_fd == -1 || (rootless && outer_fd == -1)) {
+    fprintf(stderr, "PUISNE: Couldn't open kept namespace; making anew.\n");
+    return FALSE;
+  }
+
+  char* cwd = getcwd(0, 0);  // Entering the mount namespace loses it.
+  if ((rootless && syscall(__NR_setns, outer_fd, CLONE_NEWUSER)) ||
+      syscall(__NR_setns, mnt_fd, CLONE_NEWNS) ||
+      (rootless && syscall(__NR_setns, user_fd, CLONE_NEWUSER)) ||
+      chdir(cwd)) {
+    fprintf(stderr, "PUISNE: Couldn't join kept namespace!\n");
+    exit(1);
+  }
+  free(cwd);
+  close(mnt_fd);
+  if (rootless) {
+    close(outer_fd);
+    close(user_fd);
+  }
+  return TRUE;
+}
+
+void keep_namespace(void) {
+  /*
+      Leaves a holder process in this namespace for later launches to join
+      (see `join_namespace`), until no one has for `keep_seconds`. It's a
+      grandchild, so the app never sees it as its own.
+  */
+
+  pid_t child = fork();
+  if (child) {
+    if (child != -1) {
+      waitpid(child, 0, 0);
+    }
+    return;
+  }
+  if (fork()) {
+    _exit(0);
+  }
+
+  setsid();
+  chdir("/");  // Don't hold anything busy.
+  for (int fd = 0; fd < 1024; fd++) {  // Nor open, but for the work dir's.
+    if (fd != work_lock) {
+      close(fd);
+    }
+  }
+  open("/dev/null", O_RDWR);
+  dup(0);
+  dup(0);
+
+  struct sockaddr_un addr;
+  uint32_t addr_size;
+  int sock = namespace_socket(&addr, &addr_size);
+  if (sock == -1 || bind(sock, (struct sockaddr*)&addr, addr_size) ||
+      listen(sock, 16)) {
+    _exit(0);  // eg. someone else already holds one just like it.
+  }
+
+  struct pollfd pfd = {sock, POLLIN};
+  while (poll(&pfd, 1, keep_seconds * 1000) > 0) {
+    int client = accept(sock, 0, 0);
+    if (client == -1) {
+      continue;
+    }
+    struct ucred peer;
+    uint32_t peer_size = sizeof(peer);
+    if (!getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size)) {
+      note_work_user(peer.pid);  // It'll run its app on our mounts.
+    }
+    // Wait (briefly) for it to open our namespaces & hang up.
+    struct pollfd cfd = {client, POLLIN};
+    char c;
+    if (write(client, "k", 1) == 1 && poll(&cfd, 1, 5000) > 0) {
+      while (read(client, &c, 1) > 0) {
+      }
+    }
+    close(client);
+  }
+  _exit(0);
+}
+
+char* json_string(const char* s) {
+  /*
+      `s`, quoted as a JSON string.
+  */
+
+  char* json = malloc(strlen(s) * 6 + 3);
+  char* p = json;
+  *p++ = '"';
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      *p++ = '\\';
+      *p++ = *s;
+    } else if ((unsigned char)*s < 0x20) {
+      p += sprintf(p, "\\u%04x", *s);
+    } else {
+      *p++ = *s;
+    }
+  }
+  *p++ = '"';
+  *p = '\0';
+  return json;
+}
+
+void report_stats(void) {
+  /*
+      Reports what this launch did, per `PUISNE_STATS`, as a single line of
+      JSON; in a single write, as with `trace`.
+  */
+
+  if (stats_fd == -1) {
+    return;
+  }
+  const char* rules[] = {"all",     "new",  "existing", "update",
+                         "freshen", "sync", "verify",   "lazy"};
+  const char* rule = "none";
+  for (int i = 0; i < ARRAYLEN(rules); i++) {
+    if (rules[i][0] == unzip) {
+      rule = rules[i];
+    }
+  }
+  const char* mount = tidy_mode != 'm' ? "none"
+                      : joined         ? "kept"
+                      : overlay == 'o' ? "over"
+                      : overlay == 'u' ? "under"
+                                       : "bind";
+  const char* cache = !cache_dir ? "none" : cache_missed ? "miss" : "hit";
+  char* package = json_string(name);
+  dprintf(stats_fd,
+          "{\"package\":%s,\"unzip\":\"%s\",\"mount\":\"%s\",\"cache\":\"%s\","
+          "\"cold\":%s,\"entries\":%d,\"skipped\":%llu,\"extracted\":%llu,"
+          "\"dirs\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+          "\"ms\":%.3f}\n",
+          package, rule, mount, cache,
+          stats.extracted || stats.dirs ? "true" : "false", n_entries,
+          (unsigned long long)stats.skipped,
+          (unsigned long long)stats.extracted, (unsigned long long)stats.dirs,
+          (unsigned long long)stats.bytes_read,
+          (unsigned long long)stats.bytes_written,
+          (trace_clock() - trace_epoch) / 1e6);
+  free(package);
+}
+
+void finish_in_background(void) {
+  /*
+      For `-b`, leaves a process to extract the rest (see `extract_files`) as
+      the app starts; detached, ie. a grandchild, so there's no zombie for
+      the app to reap, in a session of its own, & without the app's stdio, so
+      eg. a pipe from it closes when it's done, not when this is.
+  */
+
+  free(startup);
+  startup = 0;
+  pid_t child = fork();
+  if (child == -1) {  // Then here & now, after all.
+    extract_files();
+    return;
+  } else if (child) {
+    waitpid(child, 0, 0);  // Only until it's forked the helper.
+    return;
+  } else if (fork() > 0) {
+    _exit(0);
+  }
+
+  // The helper; or failing that, the child, waited on instead.
+  setsid();
+  int null = open("/dev/null", O_RDWR);
+  for (int fd = 0; null != -1 && fd < 3; fd++) {
+    dup2(null, fd);
+  }
+  extract_files();
+  _exit(0);
+}
+
+void extract_files_apart(void) {
+  /*
+      `extract_files` in a child, waited for, which reports its statistics
+      back; for `mount_in_namespace`, as only a single-threaded process may
+      `unshare` namespaces, & threads (`-j` workers, io_uring's) are gone
+      only some while after they're done with. Exits as the child did, if it
+      failed.
+  */
+
+  struct {
+    struct Stats stats;
+    bool cache_missed;
+  }* shared = mmap(0, sizeof(*shared), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  pid_t child = shared == MAP_FAILED ? -1 : fork();
+  if (child == -1) {  // Then here, if threads be.
+    extract_files();
+    return;
+  } else if (!child) {
+    extract_files();
+    shared->stats = stats;
+    shared->cache_missed = cache_missed;
+    _exit(0);
+  }
+
+  int status = 0;
+  while (waitpid(child, &status, 0) == -1 && errno == EINTR) {
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+  }
+  stats = shared->stats;
+  cache_missed = shared->cache_missed;
+  munmap(shared, sizeof(*shared));
+}
+
 void process_package_files(void) {
   /*
       Extracts files to unzip_dir, then handles any cleanup/localization
       procedures.
   */
 
-  if (unzip != '0') {
+  set_unzip_dir();
+  int64_t t = trace_clock();
+  if (keep_seconds && !prepare_only && join_namespace()) {
+    trace("join_namespace", 0, t);
+    joined = TRUE;
+    return;
+  }
+  if (unzip != '0' && unzip != 'l' && !warm && background) {
+    load_startup();
     extract_files();
+    trace("extract_files: startup", 0, t);
+    finish_in_background();
+  } else if (unzip != '0' && unzip != 'l' && !warm) {
+    if (tidy_mode == 'm' && !prepare_only) {
+      extract_files_apart();
+    } else {
+      extract_files();
+    }
+    trace("extract_files", 0, t);
+  }
+  if (prepare_only) {  // So the next launch is warm.
+    report_stats();
+    exit(stats.extracted || stats.dirs ? 0 : 2);
   }
   if (tidy_mode == 'm') {
+    t = trace_clock();
     mount_in_namespace();
+    trace("mount_in_namespace", 0, t);
+  }
+  if (keep_seconds) {
+    keep_namespace();
+  }
+}
+
+bool is_windows_executable(const char* path) {
+  /*
+      Whether `path` is something Windows runs by itself, ie. a PE, which
+      includes Actually Portable Executables; both begin with "MZ".
+  */
+
+  char magic[2];
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  bool is = fd != -1 && read(fd, magic, 2) == 2 && !memcmp(magic, "MZ", 2);
+  if (fd != -1) {
+    close(fd);
+  }
+  return is;
+}
+
+void exec_in_memory(char** cmd) {
+  /*
+      For `-e`, runs the entrypoint from a memfd, inflated straight out of the
+      zipOS map, so it never touches the disk; `cmd[0]` is still where it
+      would have been, for the app's sake. Returns if it's a script, so was
+      extracted as usual instead (see `entrypoint_is_script`); errors out if
+      it can't otherwise.
+  */
+
+  if (!find_entrypoint() || entrypoint_is_script()) {
+    return;
+  }
+
+  struct Zipos* zip = __zipos_get();
+  const uint8_t* data = ZIP_LFILE_CONTENT(zip->map + entrypoint.offset);
+  int fd = memfd_create(name, MFD_CLOEXEC);
+  if (fd != -1 && entrypoint.method == kZipCompressionDeflate) {
+    inflate_from_archive(fd, data, entrypoint.compressed_size, entrypoint.size,
+                         name);
+    fexecve(fd, cmd, environ);
+  } else if (fd != -1 && entrypoint.method == kZipCompressionZstd) {
+    unzstd_from_archive(fd, data, entrypoint.compressed_size, entrypoint.size,
+                        name);
+    fexecve(fd, cmd, environ);
+  } else if (fd != -1 && entrypoint.method == kZipCompressionNone) {
+    copy_from_archive(fd, data - zip->map, entrypoint.size, name);
+    fexecve(fd, cmd, environ);
   }
+
+  // eg. `vm.memfd_noexec`, or an unsupported compression method.
+  fprintf(stderr, "PUISNE: Couldn't run `%s` from memory; try without -e!\n",
+          name);
+  exit(1);
 }
 
 void launch_package(int argc, char** argv) {
   /*
       Dooooooo it.
       Grows `cmd`, basically the full `argv` for the new process.
-      In Windows, this additionally begins with `.../cmd.exe /C` to handle
-      "executable" files that aren't .exe/.com/.bat/whatever; otherwise we'd
-      need the `system` instead of `exec` family, which is a can of worms.
+      In Windows, unless the entrypoint is an executable proper, this
+      additionally begins with `.../cmd.exe /C` to handle "executable" files
+      that aren't .exe/.com/.bat/whatever; otherwise we'd need the `system`
+      instead of `exec` family, which is a can of worms.
       Just support `!#` Microsoft gawd.
   */
 
+  int64_t t = trace_clock();
   char* run_dir;
   if (tidy_mode == 'n') {
-    run_dir = unzip_dir;
+    run_dir = persist_dir;
   } else {
     run_dir = invocation_dir;
   }
 
-  char** cmd;
+  char** cmd = malloc(sizeof(char*) * (argc + 4));
   int i = 0;
-  if (IsWindows()) {
+  char* entrypoint = realpath(xstrcat(run_dir, '/', name), NULL);
+  if (!entrypoint) {  // It might not be there, with `-e`.
+    entrypoint = xjoinpaths(realpath(run_dir, NULL), name);
+  }
+  if (IsWindows() && !is_windows_executable(entrypoint)) {
     // TODO: is there a better way to handle this?
     //       eg. just `call` or `exec` instead of `cmd /C`?
     //       Doesn't seem to work, even with ftype/assoc...
     //       Ugh probably not. Apparently even `|` pipelines yield additional
     //       cmd.exe invocations like this.
-    cmd = malloc(sizeof(char*) * (argc + 4));
+    // PEs (& APEs) at least are spared the extra process, & its quoting.
     cmd[i++] = xstrcat(kNtSystemDirectory, "cmd.exe");
     cmd[i++] = "/C";
-  } else {
-    cmd = malloc(sizeof(char*) * (argc + 2));
   }
-  cmd[i++] = realpath(xstrcat(run_dir, '/', name), NULL);
+  cmd[i++] = entrypoint;
   for (int j = 0; j < argc; j++) {
     cmd[i++] = argv[j];
   }
   cmd[i++] = '\0';
 
+  trace("execv", cmd[0], t);  // ie. whatever's left is the app's own time.
+  report_stats();
+  if (memory_exec) {
+    exec_in_memory(cmd);
+  }
   int rc = execv(cmd[0], cmd);
 
   // We should never get here.
@@ -693,8 +4032,18 @@ void launch_package(int argc, char** argv) {
 }
 
 int main(int argc, char** argv) {
+  start_trace();
+  start_stats();
+  int64_t t = trace_clock();
   process_args(&argc, &argv);
+  trace("process_args", 0, t);
+  t = trace_clock();
   process_package_structure();
+  trace("process_package_structure", 0, t);
+  if (make_index) {
+    write_index();
+    exit(0);
+  }
   process_package_files();
   launch_package(argc, argv);
 